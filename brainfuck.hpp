@@ -0,0 +1,622 @@
+// brainfuck.hpp - Header-only C++20 Brainfuck evaluator that can run at compile time
+//
+// Parses, optimizes and runs a program with the semantics of execute_brainfuck in
+// sourcecode.c: a tape of byte cells (30000 by default) that either wraps around or stops
+// the program with an error at its edges, input read a line at a time, and EOF leaving
+// the cell unchanged or setting it to 0. Every function is constexpr, so a program
+// literal with a fixed input can be evaluated by the compiler into its output bytes:
+//
+//     constexpr auto letter = bf::embed<"++++++++[>++++++++<-]>+.">();  // std::array{'A'}
+//
+// bf::engine builds the interpreter for a given cell type, tape, I/O and EOF rule as
+// template arguments, so none of them cost a runtime check:
+//
+//     bf::engine<std::uint16_t, bf::growable_tape, bf::stdio_io, bf::eof_zero> interpreter;
+//     interpreter.run(code);
+//
+// Compilers cap the work done in one constant expression; long programs may need a
+// higher limit, such as -fconstexpr-ops-limit and -fconstexpr-loop-limit with GCC.
+
+#ifndef BRAINFUCK_HPP
+#define BRAINFUCK_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bf {
+
+inline constexpr std::size_t default_memory_size = 30000;
+inline constexpr std::size_t max_nested_loops = 1000;
+inline constexpr std::size_t input_buffer_size = 4096;  // Input lines are read in chunks of at most this minus 1
+
+struct config {
+    std::size_t memory_size = default_memory_size;
+    bool wrap_memory = false;
+    bool eof_zero = false;                 // Set the cell to 0 on EOF instead of leaving it unchanged
+    unsigned long long max_steps = 10000000;  // Instructions run before the program is stopped
+};
+
+enum class status {
+    ok,
+    unmatched_open,         // position is the unmatched '['
+    unmatched_close,        // position is the unmatched ']'
+    too_many_nested_loops,  // position is the '[' nested too deeply
+    out_of_bounds,          // position is the '<' or '>' that left the tape
+    step_limit,             // The program ran config::max_steps instructions
+    output_overflow,        // The program wrote more bytes than the output holds
+};
+
+enum class op : unsigned char {
+    add,     // Add arg to the cell
+    move,    // Move the pointer arg cells, all in one direction
+    clear,   // Set the cell to 0
+    output,  // Output the cell
+    input,   // Read one byte of input into the cell
+    loop,    // Skip to after instruction arg if the cell is 0
+    end,     // Go back to after instruction arg if the cell is not 0
+};
+
+struct instruction {
+    op kind;
+    int arg;
+    std::size_t pos;  // Source position of the first character
+    // Loops only: a body of adds and moves that returns the pointer and adds step (1 or -1)
+    // to the loop cell runs until the cell wraps around to 0, and reaches cells low..high,
+    // so it can be run once with its adds multiplied
+    bool simple = false;
+    int step = 0;
+    int low = 0;
+    int high = 0;
+};
+
+// Match brackets and fold the program into instructions: runs of + and -, runs of < or >,
+// clear loops, and simple loops marked for multiplication
+constexpr status parse(std::string_view code, std::vector<instruction>& program, std::size_t& position) {
+    std::vector<std::size_t> open;
+    for (std::size_t pos = 0; pos < code.size(); pos++) {
+        char c = code[pos];
+        instruction* last = program.empty() ? nullptr : &program.back();
+        switch (c) {
+        case '+':
+        case '-': {
+            int value = (c == '+') ? 1 : -1;
+            if (last && last->kind == op::add) {
+                last->arg += value;
+            }
+            else {
+                program.push_back({ op::add, value, pos });
+            }
+            break;
+        }
+        case '>':
+        case '<': {
+            int value = (c == '>') ? 1 : -1;
+            if (last && last->kind == op::move && (last->arg > 0) == (value > 0)) {
+                last->arg += value;
+            }
+            else {
+                program.push_back({ op::move, value, pos });
+            }
+            break;
+        }
+        case '.':
+            program.push_back({ op::output, 0, pos });
+            break;
+        case ',':
+            program.push_back({ op::input, 0, pos });
+            break;
+        case '[':
+            if (open.size() >= max_nested_loops) {
+                position = pos;
+                return status::too_many_nested_loops;
+            }
+            open.push_back(program.size());
+            program.push_back({ op::loop, 0, pos });
+            break;
+        case ']': {
+            if (open.empty()) {
+                position = pos;
+                return status::unmatched_close;
+            }
+            std::size_t start = open.back();
+            open.pop_back();
+            std::size_t body = start + 1;
+            if (program.size() == body + 1 && program[body].kind == op::add && (program[body].arg & 1)) {
+                // [-], [+] and any odd step reach 0 whatever the cell holds
+                std::size_t loop_pos = program[start].pos;
+                program.resize(start);
+                program.push_back({ op::clear, 0, loop_pos });
+                break;
+            }
+
+            instruction& loop = program[start];
+            int offset = 0;
+            int step = 0;
+            loop.simple = true;
+            for (std::size_t i = body; i < program.size() && loop.simple; i++) {
+                const instruction& inner = program[i];
+                if (inner.kind == op::move) {
+                    offset += inner.arg;
+                    loop.low = std::min(loop.low, offset);
+                    loop.high = std::max(loop.high, offset);
+                }
+                else if (inner.kind != op::add) {
+                    loop.simple = false;
+                }
+                else if (offset == 0) {
+                    step += inner.arg;
+                }
+            }
+            loop.simple = loop.simple && offset == 0 && (step == 1 || step == -1);
+            loop.step = step;
+            loop.arg = static_cast<int>(program.size());
+            program.push_back({ op::end, static_cast<int>(start), pos });
+            break;
+        }
+        default:
+            break;  // Comment character
+        }
+    }
+    if (!open.empty()) {
+        position = program[open.back()].pos;
+        return status::unmatched_open;
+    }
+    return status::ok;
+}
+
+// Line-buffered input over a fixed string, following read_input
+struct input_buffer {
+    std::string_view rest;
+    std::string_view line;
+    std::size_t size = 0;  // Bytes of the line before its first NUL
+    std::size_t pos = 0;
+
+    // Returns false at EOF
+    constexpr bool read(unsigned char& byte) {
+        if (pos >= size) {
+            size = 0;
+            pos = 0;
+            if (!rest.empty()) {
+                // Like fgets: up to and including the newline, at most input_buffer_size - 1 bytes
+                std::size_t length = std::min(rest.find('\n'), rest.size() - 1) + 1;
+                length = std::min(length, input_buffer_size - 1);
+                line = rest.substr(0, length);
+                rest.remove_prefix(length);
+                size = std::min(line.find('\0'), line.size());
+            }
+        }
+        if (pos >= size) {
+            return false;
+        }
+        byte = static_cast<unsigned char>(line[pos++]);
+        return true;
+    }
+};
+
+// Position of the character at which a move of the instruction leaves the tape,
+// after it moved room cells successfully
+constexpr std::size_t failing_position(std::string_view code, const instruction& move, std::size_t room) {
+    char direction = (move.arg > 0) ? '>' : '<';
+    std::size_t pos = move.pos;
+    for (;; pos++) {
+        if (code[pos] == direction && room-- == 0) {
+            return pos;
+        }
+    }
+}
+
+struct outcome {
+    bf::status status = status::ok;
+    std::size_t position = 0;
+    std::size_t length = 0;  // Output bytes written
+};
+
+// Tape policies. Each one provides storage<CellT>, the tape itself, with the pointer
+// starting at cell 0. move() returns false if the pointer would leave the tape, with
+// room set to the cells it could still move; reaches() tells whether the cells
+// low..high around the pointer can all be used without moving it.
+
+// Size cells in place, without any checks: the program must stay on the tape
+template <std::size_t Size>
+struct fixed_tape {
+    template <class CellT>
+    class storage {
+    public:
+        constexpr explicit storage(const fixed_tape&) {}
+        constexpr CellT& at(long long offset) {
+            return cells[static_cast<std::size_t>(pointer + offset)];
+        }
+        constexpr bool move(long long delta, std::size_t&) {
+            pointer += delta;
+            return true;
+        }
+        constexpr bool reaches(long long, long long) const {
+            return true;
+        }
+
+    private:
+        std::array<CellT, Size> cells{};
+        long long pointer = 0;
+    };
+};
+
+// A tape whose edges stop the program, like the interpreter without -w
+struct guarded_tape {
+    std::size_t size = default_memory_size;
+
+    template <class CellT>
+    class storage {
+    public:
+        constexpr explicit storage(const guarded_tape& policy) : cells(policy.size) {}
+        constexpr CellT& at(long long offset) {
+            return cells[static_cast<std::size_t>(pointer + offset)];
+        }
+        constexpr bool move(long long delta, std::size_t& room) {
+            long long target = pointer + delta;
+            if (target < 0 || target >= static_cast<long long>(cells.size())) {
+                room = static_cast<std::size_t>(delta > 0 ? static_cast<long long>(cells.size()) - 1 - pointer : pointer);
+                return false;
+            }
+            pointer = target;
+            return true;
+        }
+        constexpr bool reaches(long long low, long long high) const {
+            return pointer + low >= 0 && pointer + high < static_cast<long long>(cells.size());
+        }
+
+    private:
+        std::vector<CellT> cells;
+        long long pointer = 0;
+    };
+};
+
+// A tape whose ends are joined, like the interpreter with -w
+struct wrapping_tape {
+    std::size_t size = default_memory_size;
+
+    template <class CellT>
+    class storage {
+    public:
+        constexpr explicit storage(const wrapping_tape& policy) : cells(policy.size) {}
+        constexpr CellT& at(long long offset) {
+            return cells[static_cast<std::size_t>(pointer + offset)];
+        }
+        constexpr bool move(long long delta, std::size_t&) {
+            long long size = static_cast<long long>(cells.size());
+            pointer = ((pointer + delta) % size + size) % size;
+            return true;
+        }
+        constexpr bool reaches(long long low, long long high) const {
+            return pointer + low >= 0 && pointer + high < static_cast<long long>(cells.size());
+        }
+
+    private:
+        std::vector<CellT> cells;
+        long long pointer = 0;
+    };
+};
+
+// A tape that grows to the right as the pointer moves; the left edge stops the program
+struct growable_tape {
+    std::size_t initial_size = 1024;
+
+    template <class CellT>
+    class storage {
+    public:
+        constexpr explicit storage(const growable_tape& policy) : cells(policy.initial_size ? policy.initial_size : 1) {}
+        constexpr CellT& at(long long offset) {
+            return cells[static_cast<std::size_t>(pointer + offset)];
+        }
+        constexpr bool move(long long delta, std::size_t& room) {
+            if (pointer + delta < 0) {
+                room = static_cast<std::size_t>(pointer);
+                return false;
+            }
+            pointer += delta;
+            grow(pointer);
+            return true;
+        }
+        constexpr bool reaches(long long low, long long high) {
+            if (pointer + low < 0) {
+                return false;
+            }
+            grow(pointer + high);
+            return true;
+        }
+
+    private:
+        constexpr void grow(long long last) {
+            if (last >= static_cast<long long>(cells.size())) {
+                cells.resize(std::max(cells.size() * 2, static_cast<std::size_t>(last) + 1));
+            }
+        }
+
+        std::vector<CellT> cells;
+        long long pointer = 0;
+    };
+};
+
+// A tape without edges that stores only the cells the program uses. Not usable at
+// compile time.
+struct sparse_tape {
+    template <class CellT>
+    class storage {
+    public:
+        explicit storage(const sparse_tape&) {}
+        CellT& at(long long offset) {
+            return cells[pointer + offset];
+        }
+        bool move(long long delta, std::size_t&) {
+            pointer += delta;
+            return true;
+        }
+        bool reaches(long long, long long) const {
+            return true;
+        }
+
+    private:
+        std::unordered_map<long long, CellT> cells;
+        long long pointer = 0;
+    };
+};
+
+// I/O policies. put() writes one output byte and returns false if there is no room for
+// it; get() reads one input byte and returns false at EOF.
+
+// Output collected in a buffer, and input from a fixed string read a line at a time
+struct buffer_io {
+    std::vector<unsigned char> output;
+    input_buffer input;
+
+    constexpr explicit buffer_io(std::string_view text = {}) {
+        input.rest = text;
+    }
+    constexpr bool put(unsigned char byte) {
+        output.push_back(byte);
+        return true;
+    }
+    constexpr bool get(unsigned char& byte) {
+        return input.read(byte);
+    }
+};
+
+// Standard output and standard input. Not usable at compile time.
+struct stdio_io {
+    bool put(unsigned char byte) {
+        return std::putchar(byte) != EOF;
+    }
+    bool get(unsigned char& byte) {
+        int c = std::getchar();
+        if (c == EOF) {
+            return false;
+        }
+        byte = static_cast<unsigned char>(c);
+        return true;
+    }
+};
+
+// Output passed to a callback, and input from a fixed string read a line at a time
+template <class Emit>
+struct callback_io {
+    Emit emit;
+    input_buffer input;
+
+    constexpr bool put(unsigned char byte) {
+        return emit(byte);
+    }
+    constexpr bool get(unsigned char& byte) {
+        return input.read(byte);
+    }
+};
+
+// EOF policies: what reading past the end of the input does to the cell
+struct eof_unchanged {
+    template <class CellT>
+    static constexpr void apply(CellT&) {}
+};
+
+struct eof_zero {
+    template <class CellT>
+    static constexpr void apply(CellT& cell) {
+        cell = 0;
+    }
+};
+
+struct eof_minus_one {
+    template <class CellT>
+    static constexpr void apply(CellT& cell) {
+        cell = static_cast<CellT>(-1);
+    }
+};
+
+// The interpreter for one cell type, tape, I/O and EOF rule, all fixed at compile time.
+// Cells are unsigned and wrap around. The tape and I/O state persist across runs.
+template <class CellT, class TapePolicy = guarded_tape, class IOPolicy = buffer_io, class EofPolicy = eof_unchanged>
+class engine {
+    static_assert(std::is_unsigned_v<CellT>, "cells wrap around, so CellT must be an unsigned integer type");
+
+public:
+    using cell_type = CellT;
+    using tape_type = typename TapePolicy::template storage<CellT>;
+
+    constexpr explicit engine(IOPolicy io_policy = IOPolicy{}, const TapePolicy& tape_policy = TapePolicy{})
+        : io_state(std::move(io_policy)), tape_state(tape_policy) {}
+
+    constexpr IOPolicy& io() {
+        return io_state;
+    }
+    constexpr tape_type& tape() {
+        return tape_state;
+    }
+
+    // Run the program, stopping it after max_steps instructions
+    constexpr outcome run(std::string_view code, unsigned long long max_steps = ~0ULL) {
+        outcome result;
+        std::vector<instruction> program;
+        result.status = parse(code, program, result.position);
+        if (result.status != status::ok) {
+            return result;
+        }
+
+        unsigned long long steps = 0;
+        for (std::size_t pc = 0; pc < program.size(); pc++) {
+            const instruction& current = program[pc];
+            if (++steps > max_steps) {
+                result.status = status::step_limit;
+                result.position = current.pos;
+                return result;
+            }
+            switch (current.kind) {
+            case op::add:
+                tape_state.at(0) = static_cast<CellT>(tape_state.at(0) + static_cast<CellT>(current.arg));
+                break;
+            case op::move: {
+                std::size_t room = 0;
+                if (!tape_state.move(current.arg, room)) {
+                    result.status = status::out_of_bounds;
+                    result.position = failing_position(code, current, room);
+                    return result;
+                }
+                break;
+            }
+            case op::clear:
+                tape_state.at(0) = 0;
+                break;
+            case op::output:
+                if (!io_state.put(static_cast<unsigned char>(tape_state.at(0)))) {
+                    result.status = status::output_overflow;
+                    result.position = current.pos;
+                    return result;
+                }
+                result.length++;
+                break;
+            case op::input: {
+                unsigned char byte = 0;
+                if (io_state.get(byte)) {
+                    tape_state.at(0) = byte;
+                }
+                else {
+                    EofPolicy::apply(tape_state.at(0));
+                }
+                break;
+            }
+            case op::loop:
+                if (tape_state.at(0) == 0) {
+                    pc = static_cast<std::size_t>(current.arg);
+                }
+                else if (current.simple && tape_state.reaches(current.low, current.high)) {
+                    // Run the body once with its adds multiplied by the trip count
+                    CellT trips = (current.step < 0) ? tape_state.at(0) : static_cast<CellT>(0 - tape_state.at(0));
+                    long long offset = 0;
+                    for (std::size_t i = pc + 1; i < static_cast<std::size_t>(current.arg); i++) {
+                        const instruction& inner = program[i];
+                        if (inner.kind == op::move) {
+                            offset += inner.arg;
+                        }
+                        else if (offset != 0) {
+                            CellT& target = tape_state.at(offset);
+                            target = static_cast<CellT>(target + static_cast<unsigned long long>(static_cast<CellT>(inner.arg)) * trips);
+                        }
+                    }
+                    tape_state.at(0) = 0;
+                    pc = static_cast<std::size_t>(current.arg);
+                }
+                break;
+            case op::end:
+                if (tape_state.at(0) != 0) {
+                    pc = static_cast<std::size_t>(current.arg);
+                }
+                break;
+            }
+        }
+        return result;
+    }
+
+private:
+    IOPolicy io_state;
+    tape_type tape_state;
+};
+
+template <class TapePolicy, class EofPolicy, class Emit>
+constexpr outcome execute_with(std::string_view code, std::string_view input, const config& options, Emit& emit) {
+    callback_io<Emit&> io{ emit, {} };
+    io.input.rest = input;
+    engine<unsigned char, TapePolicy, callback_io<Emit&>, EofPolicy> interpreter(io, TapePolicy{ options.memory_size });
+    return interpreter.run(code, options.max_steps);
+}
+
+// Run the program with the settings of a config, passing each output byte to emit,
+// which returns false when it has no room
+template <class Emit>
+constexpr outcome execute(std::string_view code, std::string_view input, const config& options, Emit&& emit) {
+    if (options.wrap_memory) {
+        return options.eof_zero ? execute_with<wrapping_tape, eof_zero>(code, input, options, emit) :
+            execute_with<wrapping_tape, eof_unchanged>(code, input, options, emit);
+    }
+    return options.eof_zero ? execute_with<guarded_tape, eof_zero>(code, input, options, emit) :
+        execute_with<guarded_tape, eof_unchanged>(code, input, options, emit);
+}
+
+// Output of a run, in an array of the size given
+template <std::size_t N>
+struct result {
+    std::array<unsigned char, N> output{};
+    std::size_t length = 0;
+    bf::status status = status::ok;
+    std::size_t position = 0;
+};
+
+template <std::size_t N>
+constexpr result<N> run(std::string_view code, std::string_view input = {}, const config& options = {}) {
+    result<N> run_result;
+    outcome done = execute(code, input, options, [&](unsigned char byte) {
+        if (run_result.length == N) {
+            return false;
+        }
+        run_result.output[run_result.length++] = byte;
+        return true;
+    });
+    run_result.status = done.status;
+    run_result.position = done.position;
+    return run_result;
+}
+
+// Number of bytes the program writes, with the status it ends with
+constexpr outcome measure(std::string_view code, std::string_view input = {}, const config& options = {}) {
+    return execute(code, input, options, [](unsigned char) { return true; });
+}
+
+// String literal usable as a template argument
+template <std::size_t N>
+struct fixed_string {
+    char data[N]{};
+
+    constexpr fixed_string(const char (&text)[N]) {
+        std::copy_n(text, N, data);
+    }
+
+    constexpr std::string_view view() const {
+        return { data, N - 1 };
+    }
+};
+
+// Output of a program with a fixed input, computed at compile time into an array of
+// exactly its length. Programs that fail to run are rejected by the compiler.
+template <fixed_string Code, fixed_string Input = "", config Options = config{}>
+constexpr auto embed() {
+    constexpr outcome measured = measure(Code.view(), Input.view(), Options);
+    static_assert(measured.status == status::ok, "Brainfuck program failed to run at compile time");
+    constexpr result<measured.length> done = run<measured.length>(Code.view(), Input.view(), Options);
+    return done.output;
+}
+
+} // namespace bf
+
+#endif // BRAINFUCK_HPP
@@ -1,22 +1,302 @@
+#ifdef __linux__
+#define _GNU_SOURCE  // For memfd_create and MAP_32BIT, used by --jit
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#ifdef _WIN32
 #include <io.h>  // For _isatty and _fileno on Windows
+#else
+#include <errno.h>
+#include <unistd.h>    // For isatty and fileno
+#include <sys/stat.h>  // For chmod on generated executables
+// POSIX names for the Windows functions used below
+#define _isatty isatty
+#define _fileno fileno
+typedef int errno_t;
+errno_t fopen_s(FILE** file, const char* path, const char* mode) {
+    *file = fopen(path, mode);
+    return *file ? 0 : errno;
+}
+#endif
+#if defined(__linux__) && defined(__x86_64__)
+#define JIT_AVAILABLE
+#include <sys/mman.h>  // For the --jit code and data mappings
+#include <unistd.h>
+#include <signal.h>    // For breakpoints in --jit code
+#include <ucontext.h>
+#endif
 
 // Configurable parameters
 #define DEFAULT_MEMORY_SIZE 30000
 #define MAX_NESTED_LOOPS 1000
-#define MAX_PROGRAM_SIZE 1000000
+#define PROGRAM_CHUNK_SIZE 1000000
 #define INPUT_BUFFER_SIZE 4096
+#define TRACE_HOT_ITERATIONS 1000  // Loop iterations before a trace is recorded
+#define MAX_TRACE_LENGTH 256       // Longest trace kept, in instructions
+#define MAX_PENDING_ADDS 64        // Cells whose additions the compiler holds back at once
+#define MAX_SIMPLE_LOOP 256        // Longest loop body considered for multiply loop rewriting
+#define MIN_VECTOR_ADD 4           // Fewest neighbouring cell additions merged into one vector add
+#define MAX_TRACKED_CELLS 32       // Cells tracked at once by constant propagation and dead store removal
+#define MAX_UNROLLED_SIZE 1024     // Most source characters a loop with a known trip count expands to
+#define HOT_UNROLLED_SIZE 4096     // The same inside loops that were hot in the --profile-in run
+#define MIN_SHARED_LOOP 64         // Shortest repeated loop that compiled executables emit once and call
+#define TRIP_BUCKETS 16            // Trip count histogram buckets in loop profiles: 1, 2-3, 4-7, ...
+#define MAX_PEELED_TRIPS 3         // Most iterations compiled ahead of a loop that usually runs few
+#define MAX_PEELED_SIZE 256        // Most source characters those iterations may take together
+#define MIN_PEEL_ENTRIES 16        // Fewest profiled entries to judge a loop's usual trip count
+#define MAX_FOLD_STEPS 10000000    // Most steps --emit-bf runs of the program start to fold it
+#define MAX_PRECOMPUTE_STEPS 20000000  // Most steps --compile-to-exe runs a program that reads no input
+#define MAX_PRECOMPUTED_OUTPUT (1 << 20) // Most output bytes an executable holds instead of the program
+#define TRACE_EXIT_LIMIT 64        // Guard failures before a poorly performing trace is dropped
+#define MAX_MEMO_WINDOW 16         // Widest cell window a memoized loop may touch
+#define MEMO_TABLE_SIZE 4096       // Memo table slots; an entry is replaced by any later one in its slot
+#define MEMO_PROBATION 256         // Memo lookups of a loop before its hit rate is judged
+#define MAX_REWRITE_OPS 16         // Longest instruction sequence a loop is rewritten to
+#define MAX_REWRITE_INPUTS 2       // Most cells a rewritten loop may test; it is run for all their values
+#define MAX_SUPER_CANDIDATES 64    // Loops --superoptimize searches, the hottest first with --profile-in
+#define MAX_SUPER_STEPS 20000000   // Most steps spent running one loop for every input
+#define REWRITE_LINE_SIZE 1024     // Longest line of a rewrite database
+#define EXTENT_UNBOUNDED LLONG_MAX // Tape extent bound of a pointer that can move arbitrarily far
+#define PAGE_SIZE 4096             // Stride used to touch every page of the tape up front
+#define MAX_STRIDE_TARGETS 8       // Most cells one iteration of a strided loop may add to
+#define JIT_ARENA_SIZE (1 << 20)   // Bytes of code memory --jit maps at a time
+#define JIT_CACHE_LIMIT (64 << 20) // Default --jit-cache: most bytes of JIT code kept; the loops run least recently are evicted beyond it
+#define MAX_CODE_ARENAS 64
+#define MAX_BREAKPOINTS 16         // Most --break positions
 
 typedef struct {
     bool wrap_memory;        // If true, wrap around memory instead of bounds checking
     bool debug_mode;         // If true, print debug information
     unsigned int memory_size; // Size of the memory tape
     bool eof_behavior;       // If true, set cell to 0 on EOF, otherwise don't change
+    bool profile;            // If true, count executed instruction sequences and report them
+    bool memo;               // If true, remember the results of loops that only touch a few cells
+    const char* profile_out; // File to save loop counts to, NULL for none
+    const char* profile_in;  // File with loop counts from an earlier run, NULL for none
+    const char* rewrites;    // File of loop rewrites found by --superoptimize, NULL for none
+    bool jit;                // If true, compile to native code and run it in this process
+    size_t jit_cache;        // Most bytes of JIT code kept, see CodeCache
+    size_t breakpoints[MAX_BREAKPOINTS]; // Positions in the cleaned program where debug output starts
+    size_t breakpoint_count;
 } BrainfuckConfig;
 
+// Cells a program can reach, as offsets from the first cell of the tape
+typedef struct {
+    long long low;           // -EXTENT_UNBOUNDED if the pointer can move arbitrarily far left
+    long long high;          // EXTENT_UNBOUNDED if it can move arbitrarily far right
+    long long reached_high;  // Rightmost cell certainly visited: the pointer gets there before the first loop
+} TapeExtent;
+
+// Buffered line input shared by the interpreter loops
+typedef struct {
+    char data[INPUT_BUFFER_SIZE];
+    size_t pos;
+    size_t size;
+} InputBuffer;
+
+// Operations of the compiled program
+// Cells are addressed by offset from the data pointer
+typedef enum {
+    OP_ADD,     // Add arg to the cell
+    OP_ADD_VECTOR,  // Add the arg constants starting at pool index arg2 to the cells from offset on
+    OP_MUL,     // Add arg times the cell at offset arg2 to the cell
+    OP_CLEAR,   // Set the cell to 0
+    OP_SET,     // Set the cell to arg
+    OP_MOVE,    // Move the data pointer by arg cells
+    OP_BOUNDS,  // Check that offsets offset..arg stay on the tape, else run the next arg2 source characters directly
+    OP_OUTPUT,  // Output the cell
+    OP_INPUT,   // Read one byte of input into the cell
+    OP_LOOP,    // Run loop number arg while the current cell is non-zero
+    OP_IF,      // Skip the next arg instructions if the current cell is 0
+    OP_GUARD_ZERO,     // Trace only: take exit arg unless the current cell is 0
+    OP_GUARD_NONZERO,  // Trace only: take exit arg unless the current cell is non-zero
+    OP_GUARD_BOUNDS,   // Trace only: OP_BOUNDS that takes exit arg2 when the check fails
+    OP_END,        // Bytecode only: end of a loop body
+    OP_TRACE_END,  // Bytecode only: end of a trace
+    OP_HALT,       // Bytecode only: end of the program
+    OP_ADD_MOVE,   // Superinstructions: two instructions run by one dispatch
+    OP_ADD_ADD,
+    OP_BOUNDS_MOVE,
+    OP_GUARD_BOUNDS_MOVE,
+    OP_MUL_CLEAR,
+    OP_COUNT
+} OpCode;
+
+// Names used in profile reports
+const char* op_names[OP_COUNT] = {
+    "add", "add_vector", "mul", "clear", "set", "move", "bounds", "output", "input", "loop", "if",
+    "guard_zero", "guard_nonzero", "guard_bounds", "end", "trace_end", "halt",
+    "add_move", "add_add", "bounds_move", "guard_bounds_move", "mul_clear"
+};
+
+// Pairs fused into superinstructions. These were picked by hand from --profile reports of
+// a few typical programs (table setup, printing numbers, scan loops and traced nested
+// loops); tools/superinstructions.py ranks the pairs of any set of programs.
+typedef struct {
+    OpCode first;
+    OpCode second;
+    OpCode fused;
+} Superinstruction;
+
+const Superinstruction superinstructions[] = {
+    { OP_ADD, OP_MOVE, OP_ADD_MOVE },
+    { OP_GUARD_BOUNDS, OP_MOVE, OP_GUARD_BOUNDS_MOVE },
+    { OP_ADD, OP_ADD, OP_ADD_ADD },
+    { OP_BOUNDS, OP_MOVE, OP_BOUNDS_MOVE },
+    { OP_MUL, OP_CLEAR, OP_MUL_CLEAR }
+};
+
+#define SUPERINSTRUCTION_COUNT (sizeof(superinstructions) / sizeof(superinstructions[0]))
+
+// The interpreter runs a compact encoding of the instructions. Each instruction is one
+// 32-bit word holding the opcode in the low byte and its operands in the upper bytes,
+// followed by extension words for operands that do not fit:
+//   ADD, CLEAR, SET, OUTPUT, INPUT  arg (8 bits), offset (16 bits)
+//   ADD_VECTOR                 count (8 bits), offset (16 bits); constant pool index word
+//   MUL                        factor (8 bits), offset (16 bits); source offset word
+//   MOVE                       count (24 bits)
+//   BOUNDS                     low (8 bits), high (16 bits); segment index word
+//   LOOP                       loop index word
+//   IF                         word count to skip
+//   GUARD_*                    exit index (24 bits); GUARD_BOUNDS adds low and high words
+// Opcodes with OP_WIDE set keep their offset (or count, or low and high) in extension words.
+// A superinstruction keeps the encoding of both its parts and only changes the opcode of
+// the first, so its second part starts right after the first.
+#define OP_WIDE 0x80
+
+typedef struct {
+    OpCode op;
+    int arg;
+    int offset;  // Offset of the cell from the data pointer
+    int arg2;
+    size_t pos;  // Position in the cleaned source, used for error messages
+} Instruction;
+
+// A compiled loop body or the top level of the program
+typedef struct {
+    Instruction* code;
+    size_t length;
+} Block;
+
+// Constants of vector additions, shared by all blocks of a program
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+} ConstantPool;
+
+typedef struct LoopInfo LoopInfo;
+
+// Where to resume in the enclosing block when a loop exits
+typedef struct {
+    size_t pc;       // Bytecode index of the OP_LOOP (or, in trace exits, the resume point)
+    size_t start;    // Bytecode index of the start of the block
+    LoopInfo* loop;  // Loop owning the block, NULL for the top level
+    size_t shift;    // Distance from the source of the compiled block to the code it runs for
+} Frame;
+
+// Source range of a segment, kept out of line as only the slow path of OP_BOUNDS needs it
+typedef struct {
+    size_t pos;
+    size_t length;
+    size_t skip;  // Bytecode words from the OP_BOUNDS to the end of the segment
+} SegmentInfo;
+
+// All compiled blocks, stored one after another as they are compiled
+typedef struct {
+    uint32_t* words;
+    size_t length;
+    size_t capacity;
+    SegmentInfo* segments;
+    size_t segment_count;
+    size_t segment_capacity;
+    ConstantPool constants;
+} Bytecode;
+
+// Interpreter state rebuilt when a trace guard fails
+typedef struct {
+    size_t first_frame;  // Index into Trace.frames
+    size_t frame_count;  // Frames from the traced loop body down to the resume point
+} TraceExit;
+
+// One recorded iteration of a hot loop: inner loops are flattened into
+// straight-line code, with a guard wherever the recorded path branched. Traces are
+// only run by the interpreter; native code is emitted without them.
+typedef struct {
+    Block block;  // Recorded instructions, freed once the trace is encoded
+    size_t code_capacity;
+    size_t entry;  // Bytecode index of the encoded trace
+    TraceExit* exits;
+    size_t exit_count;
+    size_t exit_capacity;
+    Frame* frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    size_t shift;  // Source shift of the traced loop body while recording
+} Trace;
+
+// How often a loop ran, saved with --profile-out and loaded with --profile-in
+typedef struct {
+    unsigned long long entries;     // Times the loop was entered with a non-zero cell
+    unsigned long long iterations;
+    unsigned long long trips[TRIP_BUCKETS];  // Entries by trip count
+    unsigned long long started;     // While profiling: iterations before the running entry
+} LoopProfile;
+
+// Straight-line replacement of a loop, loaded with --rewrites. The code holds MUL, CLEAR
+// and ADD instructions with offsets from the loop cell, and has the loop's effect for
+// every value of the cells it reads.
+typedef struct {
+    Instruction code[MAX_REWRITE_OPS];
+    int length;
+    int low;   // Cells the loop can touch
+    int high;
+} Rewrite;
+
+// Loop whose body only adds to cells and moves the pointer by the same non-zero
+// stride every iteration, such as [>] or [-->>>+<]
+typedef struct {
+    int stride;  // 0 for other loops
+    int low;     // Cells one iteration reaches, as offsets from its loop cell
+    int high;
+    bool independent;  // No iteration changes a cell that a later one tests
+    int target_count;
+    int offsets[MAX_STRIDE_TARGETS];
+    unsigned char values[MAX_STRIDE_TARGETS];
+} StridedLoop;
+
+// One loop of the bracket structure
+struct LoopInfo {
+    size_t open;       // Position of '['
+    size_t close;      // Position of the matching ']'
+    size_t end_index;  // Index of the first loop that is not nested in this one
+    size_t shared;     // First loop with the same source text, whose compiled body this one reuses
+    uint32_t hash;     // Of the source text, see find_shared_loops
+    Block* body;       // Compiled on first entry by the native compiler, NULL until then
+    size_t entry;      // Bytecode index of the body, SIZE_MAX until first entry
+    bool has_inner_loops;
+    Trace* trace;      // Recorded once the loop is hot, NULL until then
+    bool untraceable;  // Set when recording failed or the trace kept exiting
+    bool hot;          // Body has been compiled again at the end of the bytecode
+    unsigned int iterations;
+    unsigned int trace_runs;
+    unsigned int trace_exits;
+    bool memo;         // Results are memoized: the loop touches only cells memo_low..memo_high
+    int memo_low;
+    int memo_high;
+    unsigned int memo_lookups;
+    unsigned int memo_hits;
+    const LoopProfile* profile;  // Counts loaded with --profile-in, NULL if the loop did not run then
+    const Rewrite* rewrite;      // Replacement loaded with --rewrites, NULL for none
+    StridedLoop strided;         // Classified on first entry by the interpreter
+};
+
+void free_block(Block* block);
+
 // Debug function to print memory state around the current pointer
 void print_debug_state(unsigned char* memory, unsigned char* ptr,
     unsigned int memory_size, size_t pc, char instruction) {
@@ -34,188 +314,5807 @@ void print_debug_state(unsigned char* memory, unsigned char* ptr,
         if (i == ptr_pos) {
             printf("[%d] ", memory[i]); // Highlight current pointer
         }
-        else {
-            printf("%d ", memory[i]);
+        else {
+            printf("%d ", memory[i]);
+        }
+    }
+    printf("\n");
+}
+
+bool is_breakpoint(const BrainfuckConfig* config, size_t pos) {
+    for (size_t i = 0; i < config->breakpoint_count; i++) {
+        if (config->breakpoints[i] == pos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Read one byte of input into the cell, refilling the line buffer when it is empty
+void read_input(InputBuffer* input, unsigned char* cell, bool eof_behavior) {
+    // If input buffer is empty or we've used all buffered input, refill it
+    if (input->pos >= input->size) {
+        input->size = 0;
+        input->pos = 0;
+
+        // Prompt for input only in interactive mode
+        if (_isatty(_fileno(stdin))) {
+            printf("\nInput: ");
+            fflush(stdout);
+        }
+
+        if (fgets(input->data, INPUT_BUFFER_SIZE, stdin) != NULL) {
+            input->size = strlen(input->data);
+        }
+    }
+
+    // Handle input
+    if (input->pos < input->size) {
+        *cell = (unsigned char)input->data[input->pos++];
+    }
+    else {
+        // EOF condition
+        if (eof_behavior) {
+            *cell = 0; // Set to 0 on EOF
+        }
+        // Otherwise leave the cell unchanged
+    }
+}
+
+// Hash table of loops keyed by the hash of their source text, with open addressing
+typedef struct {
+    size_t* slots;  // Loop index, or SIZE_MAX for an empty slot
+    size_t size;    // A power of two, at least twice the number of loops
+} LoopTable;
+
+bool loop_table_init(LoopTable* table, size_t loop_count) {
+    table->size = 16;
+    while (table->size < 2 * loop_count) {
+        table->size *= 2;
+    }
+    table->slots = (size_t*)malloc(table->size * sizeof(size_t));
+    if (!table->slots) {
+        return false;
+    }
+    for (size_t i = 0; i < table->size; i++) {
+        table->slots[i] = SIZE_MAX;
+    }
+    return true;
+}
+
+// One FNV-1a step. Loop hashes take the characters of the loop, except that each inner
+// loop counts as a single step with its own hash, so a loop's hash follows from its
+// inner loops' hashes without reading their text again.
+uint32_t loop_hash_step(uint32_t hash, uint32_t value) {
+    return (hash ^ value) * 16777619u;
+}
+
+// Hash of the loop spelled out by text, as find_shared_loops computes it, or false if
+// the text is not one loop with matching brackets
+bool text_loop_hash(const char* text, size_t length, uint32_t* hash) {
+    uint32_t stack[MAX_NESTED_LOOPS];
+    size_t depth = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '[') {
+            if (depth == MAX_NESTED_LOOPS) {
+                return false;
+            }
+            stack[depth++] = 2166136261u;
+        }
+        if (depth == 0) {
+            return false;
+        }
+        stack[depth - 1] = loop_hash_step(stack[depth - 1], (unsigned char)text[i]);
+        if (text[i] == ']') {
+            uint32_t inner = stack[--depth];
+            if (depth == 0) {
+                *hash = inner;
+                return i == length - 1;
+            }
+            stack[depth - 1] = loop_hash_step(stack[depth - 1], inner);
+        }
+    }
+    return false;
+}
+
+// Whether two loops have the same text, given that their inner loops already point at
+// the same shared loop exactly when their texts match. Only the characters outside inner
+// loops are compared.
+bool same_loop_text(const char* code, const LoopInfo* loops, size_t a, size_t b) {
+    if (loops[a].close - loops[a].open != loops[b].close - loops[b].open ||
+        loops[a].end_index - a != loops[b].end_index - b) {
+        return false;
+    }
+    size_t pos_a = loops[a].open;
+    size_t pos_b = loops[b].open;
+    for (size_t inner_a = a + 1, inner_b = b + 1; inner_a < loops[a].end_index;
+        inner_a = loops[inner_a].end_index, inner_b = loops[inner_b].end_index) {
+        size_t length = loops[inner_a].open - pos_a;
+        if (loops[inner_b].open - pos_b != length || memcmp(code + pos_a, code + pos_b, length) != 0 ||
+            loops[inner_a].shared != loops[inner_b].shared) {
+            return false;
+        }
+        pos_a = loops[inner_a].close + 1;
+        pos_b = loops[inner_b].close + 1;
+    }
+    return memcmp(code + pos_a, code + pos_b, loops[a].close - pos_a) == 0;
+}
+
+// Point every loop at the first loop with the same source text. Identical loops
+// compile to identical code, so only that first copy needs to be compiled.
+// Loops are visited innermost first, so each character is hashed and compared once
+// however deeply the loops are nested.
+void find_shared_loops(const char* code, LoopInfo* loops, size_t loop_count) {
+    for (size_t i = loop_count; i-- > 0;) {
+        uint32_t hash = 2166136261u;
+        size_t inner = i + 1;
+        for (size_t pos = loops[i].open; pos <= loops[i].close; pos++) {
+            if (inner < loops[i].end_index && pos == loops[inner].open) {
+                hash = loop_hash_step(hash, loops[inner].hash);
+                pos = loops[inner].close;
+                inner = loops[inner].end_index;
+            }
+            else {
+                hash = loop_hash_step(hash, (unsigned char)code[pos]);
+            }
+        }
+        loops[i].hash = hash;
+    }
+
+    LoopTable table;
+    if (!loop_table_init(&table, loop_count)) {
+        return; // Every loop keeps its own copy
+    }
+    // Going backwards, each loop points at the last loop with its text
+    for (size_t i = loop_count; i-- > 0;) {
+        size_t slot = loops[i].hash & (table.size - 1);
+        while (table.slots[slot] != SIZE_MAX && !same_loop_text(code, loops, table.slots[slot], i)) {
+            slot = (slot + 1) & (table.size - 1);
+        }
+        if (table.slots[slot] == SIZE_MAX) {
+            table.slots[slot] = i;
+        }
+        loops[i].shared = table.slots[slot];
+    }
+    free(table.slots);
+    // Going forwards, the last loop passes on the first loop that pointed at it
+    for (size_t i = 0; i < loop_count; i++) {
+        size_t last = loops[i].shared;
+        if (last > i) {
+            loops[i].shared = loops[last].shared < last ? loops[last].shared : i;
+            loops[last].shared = loops[i].shared;
+        }
+    }
+}
+
+// Match all brackets of the program and build the loop table.
+// Only the bracket structure is built here; loop bodies are compiled on first entry.
+bool scan_loops(const char* code, size_t code_length, LoopInfo** loops_out, size_t* loop_count_out) {
+    size_t capacity = 64;
+    size_t loop_count = 0;
+    LoopInfo* loops = (LoopInfo*)malloc(capacity * sizeof(LoopInfo));
+    size_t* open_stack = (size_t*)malloc(MAX_NESTED_LOOPS * sizeof(size_t));
+    if (!loops || !open_stack) {
+        fprintf(stderr, "Error: Memory allocation failed for loop table\n");
+        free(loops);
+        free(open_stack);
+        return false;
+    }
+
+    size_t depth = 0;
+    for (size_t pos = 0; pos < code_length; pos++) {
+        if (code[pos] == '[') {
+            if (depth >= MAX_NESTED_LOOPS) {
+                fprintf(stderr, "Error: Too many nested loops (max %d)\n", MAX_NESTED_LOOPS);
+                free(loops);
+                free(open_stack);
+                return false;
+            }
+            if (loop_count == capacity) {
+                capacity *= 2;
+                LoopInfo* grown = (LoopInfo*)realloc(loops, capacity * sizeof(LoopInfo));
+                if (!grown) {
+                    fprintf(stderr, "Error: Memory allocation failed for loop table\n");
+                    free(loops);
+                    free(open_stack);
+                    return false;
+                }
+                loops = grown;
+            }
+            loops[loop_count].open = pos;
+            loops[loop_count].close = 0;
+            loops[loop_count].end_index = 0;
+            loops[loop_count].shared = loop_count;
+            loops[loop_count].hash = 0;
+            loops[loop_count].body = NULL;
+            loops[loop_count].entry = SIZE_MAX;
+            loops[loop_count].has_inner_loops = false;
+            loops[loop_count].trace = NULL;
+            loops[loop_count].untraceable = false;
+            loops[loop_count].hot = false;
+            loops[loop_count].iterations = 0;
+            loops[loop_count].trace_runs = 0;
+            loops[loop_count].trace_exits = 0;
+            loops[loop_count].memo = false;
+            loops[loop_count].memo_low = 0;
+            loops[loop_count].memo_high = 0;
+            loops[loop_count].memo_lookups = 0;
+            loops[loop_count].memo_hits = 0;
+            loops[loop_count].profile = NULL;
+            loops[loop_count].rewrite = NULL;
+            loops[loop_count].strided.stride = 0;
+            open_stack[depth++] = loop_count++;
+        }
+        else if (code[pos] == ']') {
+            if (depth == 0) {
+                fprintf(stderr, "Error: Unmatched ']' at position %zu\n", pos);
+                free(loops);
+                free(open_stack);
+                return false;
+            }
+            LoopInfo* loop = &loops[open_stack[--depth]];
+            loop->close = pos;
+            loop->end_index = loop_count;
+        }
+    }
+
+    if (depth != 0) {
+        fprintf(stderr, "Error: Unmatched '[' at position %zu\n", loops[open_stack[depth - 1]].open);
+        free(loops);
+        free(open_stack);
+        return false;
+    }
+
+    free(open_stack);
+    find_shared_loops(code, loops, loop_count);
+    *loops_out = loops;
+    *loop_count_out = loop_count;
+    return true;
+}
+
+// Pointer movement of a loop body or the top level, relative to where it started
+typedef struct {
+    long long shift_low;   // Range of the pointer now
+    long long shift_high;
+    long long reach_low;   // Range of cells visited so far
+    long long reach_high;
+} ExtentFrame;
+
+long long extent_add(long long a, long long b) {
+    if (a == EXTENT_UNBOUNDED || a == -EXTENT_UNBOUNDED) {
+        return a;
+    }
+    if (b == EXTENT_UNBOUNDED || b == -EXTENT_UNBOUNDED) {
+        return b;
+    }
+    return a + b;
+}
+
+// Find the cells the program can reach without running it. A loop whose body always
+// returns the pointer to where it started reaches the same cells as its body; one that
+// can move the pointer on each iteration is unbounded in that direction. Returns false
+// if the brackets do not match or nest too deeply.
+bool tape_extent(const char* code, TapeExtent* extent) {
+    ExtentFrame* frames = (ExtentFrame*)calloc(MAX_NESTED_LOOPS + 1, sizeof(ExtentFrame));
+    if (!frames) {
+        return false;
+    }
+    int depth = 0;
+    bool certain = true;  // Every command so far runs: top level, before any loop or move off the tape
+    extent->reached_high = 0;
+    for (size_t pos = 0; code[pos]; pos++) {
+        ExtentFrame* frame = &frames[depth];
+        switch (code[pos]) {
+        case '>':
+            frame->shift_low = extent_add(frame->shift_low, 1);
+            frame->shift_high = extent_add(frame->shift_high, 1);
+            if (frame->shift_high > frame->reach_high) {
+                frame->reach_high = frame->shift_high;
+            }
+            if (certain) {
+                extent->reached_high = frame->reach_high;
+            }
+            break;
+        case '<':
+            frame->shift_low = extent_add(frame->shift_low, -1);
+            frame->shift_high = extent_add(frame->shift_high, -1);
+            if (frame->shift_low < frame->reach_low) {
+                frame->reach_low = frame->shift_low;
+            }
+            certain = certain && frame->shift_low >= 0;
+            break;
+        case '[':
+            if (depth == MAX_NESTED_LOOPS) {
+                free(frames);
+                return false;
+            }
+            certain = false;
+            frames[++depth] = (ExtentFrame){ 0 };
+            break;
+        case ']': {
+            if (depth == 0) {
+                free(frames);
+                return false;
+            }
+            // The loop repeats the body's shift any number of times, including none
+            ExtentFrame body = frames[depth--];
+            frame = &frames[depth];
+            long long shift_low = 0;
+            long long shift_high = 0;
+            if (body.shift_low < 0) {
+                shift_low = -EXTENT_UNBOUNDED;
+                body.reach_low = -EXTENT_UNBOUNDED;
+            }
+            if (body.shift_high > 0) {
+                shift_high = EXTENT_UNBOUNDED;
+                body.reach_high = EXTENT_UNBOUNDED;
+            }
+            long long reach_low = extent_add(frame->shift_low, body.reach_low);
+            long long reach_high = extent_add(frame->shift_high, body.reach_high);
+            if (reach_low < frame->reach_low) {
+                frame->reach_low = reach_low;
+            }
+            if (reach_high > frame->reach_high) {
+                frame->reach_high = reach_high;
+            }
+            frame->shift_low = extent_add(frame->shift_low, shift_low);
+            frame->shift_high = extent_add(frame->shift_high, shift_high);
+            break;
+        }
+        }
+    }
+    extent->low = frames[0].reach_low;
+    extent->high = frames[0].reach_high;
+    free(frames);
+    return depth == 0;
+}
+
+// Shrink the tape to the cells the program can reach. Without wrapping the pointer
+// never moves past the last of them, so the program behaves the same on the smaller
+// tape. Returns true if the tape was shrunk.
+bool fit_tape(const char* code, BrainfuckConfig* config) {
+    TapeExtent extent;
+    if (config->wrap_memory || !tape_extent(code, &extent) || extent.high == EXTENT_UNBOUNDED ||
+        extent.high + 1 >= (long long)config->memory_size) {
+        return false;
+    }
+    config->memory_size = (unsigned int)(extent.high + 1);
+    return true;
+}
+
+// Append an instruction to a block being compiled
+bool emit_instruction(Block* block, size_t* capacity, Instruction instruction) {
+    if (block->length == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        Instruction* grown = (Instruction*)realloc(block->code, new_capacity * sizeof(Instruction));
+        if (!grown) {
+            return false;
+        }
+        block->code = grown;
+        *capacity = new_capacity;
+    }
+    block->code[block->length++] = instruction;
+    return true;
+}
+
+// State of compile_block. Straight-line code is compiled in segments: inside a
+// segment the data pointer is not moved, every op addresses its cell by offset,
+// and additions are held back per cell until something reads or overwrites it.
+// The held-back value lives in the compiler, not in a register: native code emits
+// each addition as one add to the cell in memory.
+typedef struct {
+    Block* block;
+    size_t capacity;
+    ConstantPool* constants;
+    bool ok;
+
+    size_t segment_ip;     // Index of the segment's first instruction
+    size_t segment_start;  // Source position where the segment starts
+    size_t last_move;      // Source position of the segment's last '<' or '>'
+    int offset;            // Pointer offset reached so far in the segment
+    int low;               // Lowest pointer offset reached in the segment
+    int high;              // Highest pointer offset reached in the segment
+
+    int pending_count;
+    int pending_offset[MAX_PENDING_ADDS];
+    int pending_value[MAX_PENDING_ADDS];
+    size_t pending_pos[MAX_PENDING_ADDS];
+
+    // Cell values known at compile time, by offset like the pending additions (which
+    // they include). A value of -1 marks a cell as unknown. While all_zero is set,
+    // cells not listed are still 0, as at the start of the program.
+    bool all_zero;
+    int known_count;
+    int known_offset[MAX_TRACKED_CELLS];
+    int known_value[MAX_TRACKED_CELLS];
+    bool wrap;  // -w: known values do not outlive a segment that moves, see compiler_end_segment
+} Compiler;
+
+void compiler_emit(Compiler* compiler, OpCode op, int arg, int offset, int arg2, size_t pos) {
+    Instruction instruction = { .op = op, .arg = arg, .offset = offset, .arg2 = arg2, .pos = pos };
+    if (compiler->ok && !emit_instruction(compiler->block, &compiler->capacity, instruction)) {
+        compiler->ok = false;
+    }
+}
+
+// Value of the cell at offset if it is known at compile time, else -1
+int compiler_known(const Compiler* compiler, int offset) {
+    for (int i = 0; i < compiler->known_count; i++) {
+        if (compiler->known_offset[i] == offset) {
+            return compiler->known_value[i];
+        }
+    }
+    return compiler->all_zero ? 0 : -1;
+}
+
+// Emit a pending addition. If the compiler knows the cell's value, it emits that value as
+// OP_SET instead, so the value range pass in optimize_block knows it too.
+void compiler_emit_add(Compiler* compiler, int offset, int value, size_t pos) {
+    int known = compiler_known(compiler, offset);
+    compiler_emit(compiler, (known >= 0) ? OP_SET : OP_ADD, (known >= 0) ? known : value, offset, 0, pos);
+}
+
+// Write out the held-back addition to the cell at offset, if any
+void compiler_flush_add(Compiler* compiler, int offset) {
+    for (int i = 0; i < compiler->pending_count; i++) {
+        if (compiler->pending_offset[i] == offset) {
+            if (compiler->pending_value[i] != 0) {
+                compiler_emit_add(compiler, offset, compiler->pending_value[i], compiler->pending_pos[i]);
+            }
+            compiler->pending_count--;
+            compiler->pending_offset[i] = compiler->pending_offset[compiler->pending_count];
+            compiler->pending_value[i] = compiler->pending_value[compiler->pending_count];
+            compiler->pending_pos[i] = compiler->pending_pos[compiler->pending_count];
+            return;
+        }
+    }
+}
+
+// Forget the held-back addition to a cell that is about to be overwritten
+void compiler_drop_add(Compiler* compiler, int offset) {
+    for (int i = 0; i < compiler->pending_count; i++) {
+        if (compiler->pending_offset[i] == offset) {
+            compiler->pending_value[i] = 0;
+        }
+    }
+}
+
+// Append count bytes to the constant pool. Returns their index, or SIZE_MAX when out of memory.
+size_t constant_pool_add(ConstantPool* pool, const unsigned char* values, size_t count) {
+    if (pool->length + count > pool->capacity) {
+        size_t new_capacity = pool->capacity ? pool->capacity * 2 : 256;
+        while (new_capacity < pool->length + count) {
+            new_capacity *= 2;
+        }
+        unsigned char* grown = (unsigned char*)realloc(pool->data, new_capacity);
+        if (!grown) {
+            return SIZE_MAX;
+        }
+        pool->data = grown;
+        pool->capacity = new_capacity;
+    }
+    memcpy(pool->data + pool->length, values, count);
+    pool->length += count;
+    return pool->length - count;
+}
+
+// Write out all held-back additions. Runs of additions to neighbouring cells (such as
+// table setup code like >+>++>+++) become a single vector add from the constant pool.
+void compiler_flush_all(Compiler* compiler) {
+    // Sort by offset; there are at most MAX_PENDING_ADDS entries
+    for (int i = 1; i < compiler->pending_count; i++) {
+        int offset = compiler->pending_offset[i];
+        int value = compiler->pending_value[i];
+        size_t pos = compiler->pending_pos[i];
+        int j = i;
+        while (j > 0 && compiler->pending_offset[j - 1] > offset) {
+            compiler->pending_offset[j] = compiler->pending_offset[j - 1];
+            compiler->pending_value[j] = compiler->pending_value[j - 1];
+            compiler->pending_pos[j] = compiler->pending_pos[j - 1];
+            j--;
+        }
+        compiler->pending_offset[j] = offset;
+        compiler->pending_value[j] = value;
+        compiler->pending_pos[j] = pos;
+    }
+
+    int first = 0;
+    while (first < compiler->pending_count) {
+        // Extend the run over cells at most one apart; skipped cells get a zero constant
+        int last = first;
+        int nonzero = compiler->pending_value[first] != 0;
+        while (last + 1 < compiler->pending_count &&
+            compiler->pending_offset[last + 1] - compiler->pending_offset[last] <= 2) {
+            last++;
+            nonzero += compiler->pending_value[last] != 0;
+        }
+
+        if (nonzero < MIN_VECTOR_ADD) {
+            for (int i = first; i <= last; i++) {
+                if (compiler->pending_value[i] != 0) {
+                    compiler_emit_add(compiler, compiler->pending_offset[i], compiler->pending_value[i],
+                        compiler->pending_pos[i]);
+                }
+            }
+        }
+        else {
+            unsigned char values[2 * MAX_PENDING_ADDS];
+            int base = compiler->pending_offset[first];
+            int count = compiler->pending_offset[last] - base + 1;
+            size_t pos = compiler->pending_pos[first];
+            memset(values, 0, sizeof(values));
+            for (int i = first; i <= last; i++) {
+                values[compiler->pending_offset[i] - base] = (unsigned char)compiler->pending_value[i];
+                if (compiler->pending_pos[i] < pos) {
+                    pos = compiler->pending_pos[i];
+                }
+            }
+            size_t index = constant_pool_add(compiler->constants, values, (size_t)count);
+            if (index == SIZE_MAX || index > INT_MAX) {
+                compiler->ok = false;
+            }
+            compiler_emit(compiler, OP_ADD_VECTOR, count, base, (int)index, pos);
+        }
+        first = last + 1;
+    }
+    compiler->pending_count = 0;
+}
+
+void compiler_set_known(Compiler* compiler, int offset, int value) {
+    for (int i = 0; i < compiler->known_count; i++) {
+        if (compiler->known_offset[i] == offset) {
+            compiler->known_value[i] = value;
+            return;
+        }
+    }
+    if (compiler->known_count < MAX_TRACKED_CELLS) {
+        compiler->known_offset[compiler->known_count] = offset;
+        compiler->known_value[compiler->known_count] = value;
+        compiler->known_count++;
+    }
+    else if (compiler->all_zero) {
+        // No room to record the change, so stop assuming unlisted cells are 0
+        compiler->all_zero = false;
+    }
+}
+
+// Forget all known values, except that the current cell is 0 (as after a loop)
+void compiler_forget(Compiler* compiler) {
+    compiler->all_zero = false;
+    compiler->known_count = 0;
+    compiler_set_known(compiler, compiler->offset, 0);
+}
+
+void compiler_add(Compiler* compiler, int offset, int delta, size_t pos) {
+    int known = compiler_known(compiler, offset);
+    if (known >= 0) {
+        compiler_set_known(compiler, offset, (known + delta) & 0xFF);
+    }
+    for (int i = 0; i < compiler->pending_count; i++) {
+        if (compiler->pending_offset[i] == offset) {
+            compiler->pending_value[i] = (compiler->pending_value[i] + delta) & 0xFF;
+            return;
+        }
+    }
+    if (compiler->pending_count == MAX_PENDING_ADDS) {
+        compiler_flush_all(compiler);
+    }
+    compiler->pending_offset[compiler->pending_count] = offset;
+    compiler->pending_value[compiler->pending_count] = delta & 0xFF;
+    compiler->pending_pos[compiler->pending_count] = pos;
+    compiler->pending_count++;
+}
+
+void compiler_reach(Compiler* compiler, int low, int high) {
+    if (low < compiler->low) {
+        compiler->low = low;
+    }
+    if (high > compiler->high) {
+        compiler->high = high;
+    }
+}
+
+// Close the segment that ends at source position end: write out held-back additions,
+// apply the pointer movement once, and put a bounds check in front of the segment
+void compiler_end_segment(Compiler* compiler, size_t end) {
+    compiler_flush_all(compiler);
+    if (compiler->offset != 0) {
+        compiler_emit(compiler, OP_MOVE, compiler->offset, 0, 0, compiler->last_move);
+    }
+    if ((compiler->low < 0 || compiler->high > 0) && compiler->ok) {
+        Instruction bounds = { .op = OP_BOUNDS, .arg = compiler->high, .offset = compiler->low,
+            .arg2 = (int)(end - compiler->segment_start), .pos = compiler->segment_start };
+        if (!emit_instruction(compiler->block, &compiler->capacity, bounds)) {
+            compiler->ok = false;
+            return;
+        }
+        Block* block = compiler->block;
+        memmove(&block->code[compiler->segment_ip + 1], &block->code[compiler->segment_ip],
+            (block->length - 1 - compiler->segment_ip) * sizeof(Instruction));
+        block->code[compiler->segment_ip] = bounds;
+    }
+    compiler->segment_ip = compiler->block->length;
+    compiler->segment_start = end;
+    if (compiler->wrap && (compiler->low < 0 || compiler->high > 0)) {
+        // If the bounds check fails, the segment runs from source and the pointer wraps
+        // around the tape, where cells at different offsets may be the same one
+        compiler->all_zero = false;
+        compiler->known_count = 0;
+    }
+    for (int i = 0; i < compiler->known_count; i++) {
+        compiler->known_offset[i] -= compiler->offset;
+    }
+    compiler->offset = 0;
+    compiler->low = 0;
+    compiler->high = 0;
+}
+
+// Check whether the loop [open, close] only adds and moves, returns the pointer to
+// where it started, and changes its own cell by 1 or -1 per iteration. Such a loop
+// adds a multiple of its cell to each target and then clears it.
+bool parse_multiply_loop(const char* code, size_t open, size_t close, int* targets, int* factors,
+    int* target_count, int* low, int* high) {
+    if (close - open > MAX_SIMPLE_LOOP) {
+        return false;
+    }
+
+    int offset = 0;
+    int self = 0;
+    int count = 0;
+    *low = 0;
+    *high = 0;
+    for (size_t pos = open + 1; pos < close; pos++) {
+        switch (code[pos]) {
+        case '>':
+            offset++;
+            if (offset > *high) {
+                *high = offset;
+            }
+            break;
+        case '<':
+            offset--;
+            if (offset < *low) {
+                *low = offset;
+            }
+            break;
+        case '+':
+        case '-': {
+            int delta = (code[pos] == '+') ? 1 : -1;
+            if (offset == 0) {
+                self += delta;
+                break;
+            }
+            int i = 0;
+            while (i < count && targets[i] != offset) {
+                i++;
+            }
+            if (i == count) {
+                if (count == MAX_PENDING_ADDS) {
+                    return false;
+                }
+                targets[count] = offset;
+                factors[count] = 0;
+                count++;
+            }
+            factors[i] += delta;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    self &= 0xFF;
+    if (offset != 0 || (self != 1 && self != 0xFF)) {
+        return false;
+    }
+
+    // A cell counting down runs v iterations; one counting up runs 256 - v
+    for (int i = 0; i < count; i++) {
+        factors[i] = ((self == 0xFF) ? factors[i] : -factors[i]) & 0xFF;
+    }
+    *target_count = count;
+    return true;
+}
+
+// Loops that ran at least TRACE_HOT_ITERATIONS iterations in the profiled run
+bool profile_hot(const LoopInfo* loop) {
+    return loop->profile && loop->profile->iterations >= TRACE_HOT_ITERATIONS;
+}
+
+// Iterations worth compiling ahead of a loop: the smallest trip count bucket bound
+// that covered at least 90% of its entries in the profiled run, up to MAX_PEELED_TRIPS.
+// Returns 0 when the loop has no such profile or the iterations would be too large.
+int peel_count(const LoopInfo* loop) {
+    const LoopProfile* profile = loop->profile;
+    if (!profile || profile->entries < MIN_PEEL_ENTRIES) {
+        return 0;
+    }
+    unsigned long long covered = 0;
+    for (int bucket = 0; bucket < TRIP_BUCKETS; bucket++) {
+        int trips = (2 << bucket) - 1;  // Largest trip count in the bucket
+        if (trips > MAX_PEELED_TRIPS) {
+            break;
+        }
+        covered += profile->trips[bucket];
+        if (covered * 10 >= profile->entries * 9) {
+            return (size_t)trips * (loop->close - loop->open) <= MAX_PEELED_SIZE ? trips : 0;
+        }
+    }
+    return 0;
+}
+
+// Trip count of loop number index, entered with its cell at value, if its body can be
+// expanded inline: it may only add, move, run multiply loops and do I/O on other cells,
+// must return the pointer to where it started and must change its own cell by the same
+// amount on every iteration. Returns -1 otherwise, or when the expansion would be larger
+// than limit source characters.
+int unroll_count(const char* code, const LoopInfo* loops, size_t index, int value, size_t limit) {
+    const LoopInfo* loop = &loops[index];
+    int offset = 0;
+    int delta = 0;
+    size_t next = index + 1;
+    for (size_t pos = loop->open + 1; pos < loop->close; pos++) {
+        switch (code[pos]) {
+        case '+':
+        case '-':
+            if (offset == 0) {
+                delta += (code[pos] == '+') ? 1 : -1;
+            }
+            break;
+        case '>':
+            offset++;
+            break;
+        case '<':
+            offset--;
+            break;
+        case ',':
+            if (offset == 0) {
+                return -1;
+            }
+            break;
+        case '[': {
+            const LoopInfo* inner = &loops[next];
+            int targets[MAX_PENDING_ADDS];
+            int factors[MAX_PENDING_ADDS];
+            int target_count = 0;
+            int low = 0;
+            int high = 0;
+            if (offset == 0 || !parse_multiply_loop(code, pos, inner->close, targets, factors, &target_count, &low, &high)) {
+                return -1;
+            }
+            for (int i = 0; i < target_count; i++) {
+                if (offset + targets[i] == 0) {
+                    return -1;
+                }
+            }
+            pos = inner->close;
+            next = inner->end_index;
+            break;
+        }
+        }
+    }
+    if (offset != 0 || (delta & 0xFF) == 0) {
+        return -1;
+    }
+
+    for (int trips = 1; trips <= 256; trips++) {
+        if (((value + trips * delta) & 0xFF) == 0) {
+            return (size_t)trips * (loop->close - loop->open) <= limit ? trips : -1;
+        }
+    }
+    return -1;  // The cell never reaches 0
+}
+
+// Set of cell offsets used by optimize_block. When it is full, further cells are not
+// tracked, which only makes the analysis more conservative.
+typedef struct {
+    int offsets[MAX_TRACKED_CELLS];
+    int count;
+} CellSet;
+
+bool cell_set_has(const CellSet* set, int offset) {
+    for (int i = 0; i < set->count; i++) {
+        if (set->offsets[i] == offset) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void cell_set_add(CellSet* set, int offset) {
+    if (!cell_set_has(set, offset) && set->count < MAX_TRACKED_CELLS) {
+        set->offsets[set->count++] = offset;
+    }
+}
+
+void cell_set_remove(CellSet* set, int offset) {
+    for (int i = 0; i < set->count; i++) {
+        if (set->offsets[i] == offset) {
+            set->offsets[i] = set->offsets[--set->count];
+            return;
+        }
+    }
+}
+
+// Offsets are relative to the data pointer, so they shift when it moves
+void cell_set_shift(CellSet* set, int delta) {
+    for (int i = 0; i < set->count; i++) {
+        set->offsets[i] += delta;
+    }
+}
+
+// Values cells can hold, used by optimize_block: each tracked cell lies in low..high
+// without wrapping around. Untracked cells can hold anything.
+typedef struct {
+    int offsets[MAX_TRACKED_CELLS];
+    unsigned char low[MAX_TRACKED_CELLS];
+    unsigned char high[MAX_TRACKED_CELLS];
+    int count;
+} CellRanges;
+
+void cell_range(const CellRanges* ranges, int offset, int* low, int* high) {
+    for (int i = 0; i < ranges->count; i++) {
+        if (ranges->offsets[i] == offset) {
+            *low = ranges->low[i];
+            *high = ranges->high[i];
+            return;
+        }
+    }
+    *low = 0;
+    *high = 0xFF;
+}
+
+void set_cell_range(CellRanges* ranges, int offset, int low, int high) {
+    int i = 0;
+    while (i < ranges->count && ranges->offsets[i] != offset) {
+        i++;
+    }
+    if (low == 0 && high == 0xFF) {
+        if (i < ranges->count) {
+            ranges->count--;
+            ranges->offsets[i] = ranges->offsets[ranges->count];
+            ranges->low[i] = ranges->low[ranges->count];
+            ranges->high[i] = ranges->high[ranges->count];
+        }
+        return;
+    }
+    if (i == ranges->count) {
+        if (ranges->count == MAX_TRACKED_CELLS) {
+            return;
+        }
+        ranges->offsets[ranges->count++] = offset;
+    }
+    ranges->low[i] = (unsigned char)low;
+    ranges->high[i] = (unsigned char)high;
+}
+
+// Add low..high to the cell. Its range survives if the sums fit in one turn of 256.
+void add_cell_range(CellRanges* ranges, int offset, int low, int high) {
+    int cell_low;
+    int cell_high;
+    cell_range(ranges, offset, &cell_low, &cell_high);
+    low += cell_low;
+    high += cell_high;
+    if (high - low > 0xFF) {
+        set_cell_range(ranges, offset, 0, 0xFF);
+        return;
+    }
+    int turns = (low >= 0) ? low / 256 : -((255 - low) / 256);
+    low -= 256 * turns;
+    high -= 256 * turns;
+    if (high > 0xFF) {
+        low = 0;
+        high = 0xFF;
+    }
+    set_cell_range(ranges, offset, low, high);
+}
+
+void shift_cell_ranges(CellRanges* ranges, int delta) {
+    for (int i = 0; i < ranges->count; i++) {
+        ranges->offsets[i] += delta;
+    }
+}
+
+// Keep the ranges that hold on either of two paths
+void join_cell_ranges(CellRanges* ranges, const CellRanges* other) {
+    for (int i = ranges->count; i-- > 0;) {
+        int low;
+        int high;
+        cell_range(other, ranges->offsets[i], &low, &high);
+        set_cell_range(ranges, ranges->offsets[i], (ranges->low[i] < low) ? ranges->low[i] : low,
+            (ranges->high[i] > high) ? ranges->high[i] : high);
+    }
+}
+
+// Cell ranges on the path that skips an OP_IF, to be joined where it lands
+typedef struct {
+    size_t target;
+    long long moves;  // Pointer moves and loops run before the branch: the ranges only
+    size_t loops;     // line up with the other path if neither changed since
+    CellRanges ranges;
+} BranchState;
+
+// Simplify the block using value ranges, then remove stores whose value is never
+// observed. A forward pass tracks the range of values cells can hold (cleared and set
+// cells, constants added to them, flags set behind a branch, the current cell after a
+// loop): clearing cells known to be 0 and multiplying by them do nothing, multiplying by
+// a known value is an addition, and adding to a known value becomes OP_SET. An OP_IF on a
+// cell that cannot be 0 falls through, and one on a cell known to be 0 skips its body,
+// so the test or the body is removed. A backward pass then tracks cells that are
+// overwritten before being read, and removes additions, clears and multiplications into
+// them. Both passes give up at loops; the backward pass also at branches. With wrap (-w)
+// the ranges found in a segment with a bounds check are dropped where it ends: if the
+// check fails, the pointer wraps and cells at different offsets may be the same one.
+bool optimize_block(Block* block, bool wrap) {
+    bool* removed = (bool*)calloc(block->length + 1, sizeof(bool));
+    bool* joins = (bool*)calloc(block->length + 1, sizeof(bool));
+    size_t branch_count = 0;
+    for (size_t ip = 0; joins && ip < block->length; ip++) {
+        if (block->code[ip].op == OP_IF) {
+            joins[ip + 1 + (size_t)block->code[ip].arg] = true;
+            branch_count++;
+        }
+    }
+    BranchState* branches = (BranchState*)malloc((branch_count + 1) * sizeof(BranchState));
+    if (!removed || !joins || !branches) {
+        free(removed);
+        free(joins);
+        free(branches);
+        return false;
+    }
+
+    CellRanges ranges = { .count = 0 };
+    size_t open_branches = 0;
+    long long moves = 0;
+    size_t loops = 0;
+    bool guarded = false;  // In a segment with a bounds check, under wrap
+    for (size_t ip = 0; ip < block->length; ip++) {
+        Instruction* instruction = &block->code[ip];
+        OpCode op = instruction->op;
+        if (guarded && (joins[ip] || op == OP_MOVE || op == OP_BOUNDS || op == OP_LOOP || op == OP_IF)) {
+            ranges.count = 0;
+            guarded = false;
+        }
+        if (joins[ip]) {
+            while (open_branches > 0 && branches[open_branches - 1].target == ip) {
+                BranchState* branch = &branches[--open_branches];
+                if (branch->moves == moves && branch->loops == loops) {
+                    join_cell_ranges(&ranges, &branch->ranges);
+                }
+                else {
+                    ranges.count = 0;
+                }
+            }
+            // Reached with the current cell at 0 whether or not the branch was taken
+            set_cell_range(&ranges, 0, 0, 0);
+        }
+        int low;
+        int high;
+        switch (instruction->op) {
+        case OP_ADD:
+            cell_range(&ranges, instruction->offset, &low, &high);
+            if (low == high) {
+                instruction->op = OP_SET;
+                instruction->arg = (low + instruction->arg) & 0xFF;
+                set_cell_range(&ranges, instruction->offset, instruction->arg, instruction->arg);
+            }
+            else {
+                add_cell_range(&ranges, instruction->offset, instruction->arg, instruction->arg);
+            }
+            break;
+        case OP_ADD_VECTOR:
+            for (int i = 0; i < instruction->arg; i++) {
+                set_cell_range(&ranges, instruction->offset + i, 0, 0xFF);
+            }
+            break;
+        case OP_MUL:
+            cell_range(&ranges, instruction->arg2, &low, &high);
+            if (high == 0) {
+                removed[ip] = true;
+            }
+            else if (low == high) {
+                // Known multiplier: an addition, handled as one
+                instruction->op = OP_ADD;
+                instruction->arg = (low * instruction->arg) & 0xFF;
+                instruction->arg2 = 0;
+                ip--;
+                continue;
+            }
+            else if (instruction->offset == instruction->arg2) {
+                set_cell_range(&ranges, instruction->offset, 0, 0xFF);
+            }
+            else {
+                // Factors above 128 are negative, which keeps ranges such as flag * -1 tight
+                int factor = (instruction->arg > 128) ? instruction->arg - 256 : instruction->arg;
+                add_cell_range(&ranges, instruction->offset, (factor < 0) ? high * factor : low * factor,
+                    (factor < 0) ? low * factor : high * factor);
+            }
+            break;
+        case OP_CLEAR:
+            cell_range(&ranges, instruction->offset, &low, &high);
+            if (high == 0) {
+                removed[ip] = true;
+            }
+            set_cell_range(&ranges, instruction->offset, 0, 0);
+            break;
+        case OP_SET:
+            set_cell_range(&ranges, instruction->offset, instruction->arg, instruction->arg);
+            break;
+        case OP_INPUT:
+            set_cell_range(&ranges, instruction->offset, 0, 0xFF);
+            break;
+        case OP_MOVE:
+            shift_cell_ranges(&ranges, -instruction->arg);
+            moves += instruction->arg;
+            break;
+        case OP_BOUNDS:
+            guarded = wrap;
+            break;
+        case OP_LOOP:
+            ranges.count = 0;
+            set_cell_range(&ranges, 0, 0, 0);
+            loops++;
+            break;
+        case OP_IF: {
+            size_t target = ip + 1 + (size_t)instruction->arg;
+            cell_range(&ranges, 0, &low, &high);
+            removed[ip] = (low > 0 || high == 0);
+            if (high == 0) {
+                // Always skips: the body goes too, and the analysis resumes where it lands
+                for (size_t skipped = ip + 1; skipped < target; skipped++) {
+                    removed[skipped] = true;
+                }
+                ip = target - 1;
+                break;
+            }
+            if (low == 0) {
+                branches[open_branches++] = (BranchState){ .target = target, .moves = moves, .loops = loops,
+                    .ranges = ranges };
+                set_cell_range(&branches[open_branches - 1].ranges, 0, 0, 0);
+                set_cell_range(&ranges, 0, 1, high);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    CellSet dead = { .count = 0 };
+    for (size_t ip = block->length; ip-- > 0;) {
+        Instruction* instruction = &block->code[ip];
+        if (joins[ip + 1]) {
+            dead.count = 0;
+        }
+        if (removed[ip]) {
+            continue;
+        }
+        switch (instruction->op) {
+        case OP_ADD:
+            removed[ip] = cell_set_has(&dead, instruction->offset);
+            break;
+        case OP_ADD_VECTOR:
+            for (int i = 0; i < instruction->arg; i++) {
+                cell_set_remove(&dead, instruction->offset + i);
+            }
+            break;
+        case OP_MUL:
+            if (cell_set_has(&dead, instruction->offset)) {
+                removed[ip] = true;
+            }
+            else {
+                cell_set_remove(&dead, instruction->arg2);
+            }
+            break;
+        case OP_CLEAR:
+        case OP_SET:
+            if (cell_set_has(&dead, instruction->offset)) {
+                removed[ip] = true;
+            }
+            cell_set_add(&dead, instruction->offset);
+            break;
+        case OP_OUTPUT:
+        case OP_INPUT:
+            cell_set_remove(&dead, instruction->offset);
+            break;
+        case OP_MOVE:
+            cell_set_shift(&dead, instruction->arg);
+            break;
+        case OP_LOOP:
+        case OP_IF:
+        case OP_BOUNDS:
+            // A bounds check that fails runs the segment from source, which may read any cell
+            dead.count = 0;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Compact the block, keeping branch distances in step
+    free(joins);
+    free(branches);
+    size_t* new_index = (size_t*)malloc((block->length + 1) * sizeof(size_t));
+    if (!new_index) {
+        free(removed);
+        return false;
+    }
+    size_t kept = 0;
+    for (size_t ip = 0; ip <= block->length; ip++) {
+        new_index[ip] = kept;
+        if (ip < block->length && !removed[ip]) {
+            kept++;
+        }
+    }
+    for (size_t ip = 0; ip < block->length; ip++) {
+        Instruction instruction = block->code[ip];
+        if (removed[ip]) {
+            continue;
+        }
+        if (instruction.op == OP_IF) {
+            instruction.arg = (int)(new_index[ip + 1 + (size_t)instruction.arg] - new_index[ip] - 1);
+        }
+        block->code[new_index[ip]] = instruction;
+    }
+    block->length = kept;
+    free(new_index);
+    free(removed);
+    return true;
+}
+
+// Compile the code in [start, end) into a block. Nested loops are not compiled here:
+// they become OP_LOOP and are compiled on first entry. first_loop is the loop table
+// index of the first '[' in the range. Vector add constants go to the constant pool.
+// wrap is set for -w, where the pointer wraps around the tape.
+Block* compile_block(const char* code, size_t start, size_t end, LoopInfo* loops, size_t first_loop,
+    ConstantPool* constants, bool wrap) {
+    Block* block = (Block*)calloc(1, sizeof(Block));
+    if (!block) {
+        fprintf(stderr, "Error: Memory allocation failed while compiling\n");
+        return NULL;
+    }
+
+    // Only the top level of the program starts at 0, where the whole tape is still 0
+    Compiler compiler = { .block = block, .constants = constants, .ok = true, .segment_start = start,
+        .all_zero = (start == 0), .wrap = wrap };
+    size_t next_loop = first_loop;
+    size_t open_ifs[MAX_NESTED_LOOPS + MAX_PEELED_TRIPS];  // Indices of the OP_IF of enclosing inline loops
+    int if_depth = 0;
+    size_t unroll_loop = 0;  // Loop being expanded, and the iterations still to compile
+    int unroll_left = 0;
+    size_t peel_loop = 0;    // Loop whose first iterations are compiled inline, the iterations
+    int peel_left = 0;       // still to compile and the if_depth outside them
+    int peel_depth = 0;
+    int peel = 0;
+
+    // Expand further inside loops that were hot in the profiled run
+    bool hot = first_loop > 0 && loops[first_loop - 1].open + 1 == start && profile_hot(&loops[first_loop - 1]);
+    size_t unroll_limit = hot ? HOT_UNROLLED_SIZE : MAX_UNROLLED_SIZE;
+    for (size_t pos = start; compiler.ok && pos < end; pos++) {
+        switch (code[pos]) {
+        case '+':
+            compiler_add(&compiler, compiler.offset, 1, pos);
+            break;
+
+        case '-':
+            compiler_add(&compiler, compiler.offset, -1, pos);
+            break;
+
+        case '>':
+        case '<':
+            compiler.offset += (code[pos] == '>') ? 1 : -1;
+            compiler.last_move = pos;
+            compiler_reach(&compiler, compiler.offset, compiler.offset);
+            break;
+
+        case '.':
+            compiler_flush_add(&compiler, compiler.offset);
+            compiler_emit(&compiler, OP_OUTPUT, 0, compiler.offset, 0, pos);
+            break;
+
+        case ',':
+            compiler_flush_add(&compiler, compiler.offset);
+            compiler_emit(&compiler, OP_INPUT, 0, compiler.offset, 0, pos);
+            compiler_set_known(&compiler, compiler.offset, -1);
+            break;
+
+        case '[': {
+            LoopInfo* loop = &loops[next_loop];
+            int known = compiler_known(&compiler, compiler.offset);
+            int targets[MAX_PENDING_ADDS];
+            int factors[MAX_PENDING_ADDS];
+            int target_count = 0;
+            int low = 0;
+            int high = 0;
+            int trips = -1;
+            if (known == 0) {
+                // The loop never runs (such as a comment loop at the start of the program)
+            }
+            else if (parse_multiply_loop(code, pos, loop->close, targets, factors, &target_count, &low, &high)) {
+                // Clear and multiply loops stay inside the segment. With a known trip count
+                // the multiplications are folded into additions.
+                if (target_count > 0 && known < 0) {
+                    compiler_flush_add(&compiler, compiler.offset);
+                }
+                else {
+                    compiler_drop_add(&compiler, compiler.offset);
+                }
+                compiler_reach(&compiler, compiler.offset + low, compiler.offset + high);
+                for (int i = 0; i < target_count; i++) {
+                    int target = compiler.offset + targets[i];
+                    if (known >= 0) {
+                        compiler_add(&compiler, target, (known * factors[i]) & 0xFF, pos);
+                    }
+                    else if (factors[i] != 0) {
+                        compiler_emit(&compiler, OP_MUL, factors[i], target, compiler.offset, pos);
+                        compiler_set_known(&compiler, target, -1);
+                    }
+                }
+                compiler_emit(&compiler, OP_CLEAR, 0, compiler.offset, 0, pos);
+                compiler_set_known(&compiler, compiler.offset, 0);
+            }
+            else if (loop->rewrite) {
+                // Rewritten by --superoptimize: the instructions read the loop's input
+                // cells, so their pending additions go first
+                const Rewrite* rewrite = loop->rewrite;
+                compiler_reach(&compiler, compiler.offset + rewrite->low, compiler.offset + rewrite->high);
+                for (int i = 0; i < rewrite->length; i++) {
+                    const Instruction* instruction = &rewrite->code[i];
+                    int target = compiler.offset + instruction->offset;
+                    if (instruction->op == OP_MUL) {
+                        compiler_flush_add(&compiler, compiler.offset + instruction->arg2);
+                        compiler_emit(&compiler, OP_MUL, instruction->arg, target, compiler.offset + instruction->arg2, pos);
+                        compiler_set_known(&compiler, target, -1);
+                    }
+                    else if (instruction->op == OP_CLEAR) {
+                        compiler_drop_add(&compiler, target);
+                        compiler_emit(&compiler, OP_CLEAR, 0, target, 0, pos);
+                        compiler_set_known(&compiler, target, 0);
+                    }
+                    else {
+                        compiler_add(&compiler, target, instruction->arg, pos);
+                    }
+                }
+            }
+            else if (known > 0 && unroll_left == 0 && (trips = unroll_count(code, loops, next_loop, known, unroll_limit)) > 0) {
+                // Known trip count: compile the body that many times as straight-line code
+                // within the current segment, whose source fallback still runs the loop
+                unroll_loop = next_loop;
+                unroll_left = trips;
+                next_loop++;
+                break;
+            }
+            else if (code[loop->close - 1] == ']') {
+                // The body ends with an inner loop, which leaves the cell at 0, so the
+                // loop runs at most once: compile it inline behind a forward branch
+                compiler_end_segment(&compiler, pos);
+                open_ifs[if_depth++] = block->length;
+                compiler_emit(&compiler, OP_IF, 0, 0, 0, pos);
+                compiler.segment_ip = block->length;
+                compiler.segment_start = pos + 1;
+                next_loop++;
+                break;
+            }
+            else if (peel_left == 0 && (peel = peel_count(loop)) > 0) {
+                // The loop nearly always ran at most peel iterations in the profiled run:
+                // compile those inline, each behind a forward branch, then the loop itself
+                // for any further iterations
+                compiler_end_segment(&compiler, pos);
+                peel_loop = next_loop;
+                peel_left = peel;
+                peel_depth = if_depth;
+                open_ifs[if_depth++] = block->length;
+                compiler_emit(&compiler, OP_IF, 0, 0, 0, pos);
+                compiler.segment_ip = block->length;
+                compiler.segment_start = pos + 1;
+                next_loop++;
+                break;
+            }
+            else {
+                compiler_end_segment(&compiler, pos);
+                compiler_emit(&compiler, OP_LOOP, (int)next_loop, 0, 0, pos);
+                compiler.segment_ip = block->length;
+                compiler.segment_start = loop->close + 1;
+                compiler_forget(&compiler);
+            }
+            // Skip the body; it is compiled when the loop is first entered
+            pos = loop->close;
+            next_loop = loop->end_index;
+            break;
+        }
+
+        case ']':
+            if (unroll_left > 0 && pos == loops[unroll_loop].close) {
+                // End of one expanded iteration
+                if (--unroll_left > 0) {
+                    pos = loops[unroll_loop].open;
+                    next_loop = unroll_loop + 1;
+                }
+                break;
+            }
+            if (peel_left > 0 && pos == loops[peel_loop].close) {
+                compiler_end_segment(&compiler, pos);
+                if (--peel_left > 0) {
+                    // Next inline iteration
+                    open_ifs[if_depth++] = block->length;
+                    compiler_emit(&compiler, OP_IF, 0, 0, 0, pos);
+                    compiler.segment_ip = block->length;
+                    compiler.segment_start = loops[peel_loop].open + 1;
+                    pos = loops[peel_loop].open;
+                    next_loop = peel_loop + 1;
+                    break;
+                }
+                // All forward branches skip to after the loop
+                compiler_emit(&compiler, OP_LOOP, (int)peel_loop, 0, 0, loops[peel_loop].open);
+                while (if_depth > peel_depth) {
+                    if_depth--;
+                    if (compiler.ok) {
+                        block->code[open_ifs[if_depth]].arg = (int)(block->length - open_ifs[if_depth] - 1);
+                    }
+                }
+                compiler.segment_ip = block->length;
+                compiler.segment_start = pos + 1;
+                compiler_forget(&compiler);
+                break;
+            }
+            // End of an inline at-most-once loop
+            compiler_end_segment(&compiler, pos);
+            if_depth--;
+            if (compiler.ok) {
+                block->code[open_ifs[if_depth]].arg = (int)(block->length - open_ifs[if_depth] - 1);
+            }
+            compiler.segment_start = pos + 1;
+            compiler_forget(&compiler);
+            break;
+        }
+
+        // Keep source spans of segments representable in an instruction
+        if (unroll_left == 0 && pos + 1 - compiler.segment_start >= INT_MAX / 2) {
+            compiler_end_segment(&compiler, pos + 1);
+        }
+    }
+    compiler_end_segment(&compiler, end);
+
+    if (!compiler.ok || !optimize_block(block, wrap)) {
+        fprintf(stderr, "Error: Memory allocation failed while compiling\n");
+        free_block(block);
+        return NULL;
+    }
+    return block;
+}
+
+void free_block(Block* block) {
+    if (block) {
+        free(block->code);
+        free(block);
+    }
+}
+
+// Execute the source range [start, end) one character at a time. Used for debug
+// mode, for segments running too close to the tape edges for the compiled code and
+// for JIT code stopped at a breakpoint, which may stop inside loops. Debug output
+// starts at the first breakpoint reached. Returns false if the program stopped with
+// an error.
+bool execute_range(const char* code, size_t start, size_t end, unsigned char* memory,
+    unsigned char** ptr_io, const BrainfuckConfig* config, InputBuffer* input) {
+    unsigned char* ptr = *ptr_io; // Data pointer
+    bool tracing = config->debug_mode;
+
+    // Stack to keep track of loop positions
+    size_t* loop_stack = (size_t*)malloc(MAX_NESTED_LOOPS * sizeof(size_t));
+    if (!loop_stack) {
+        fprintf(stderr, "Error: Memory allocation failed for loop stack\n");
+        return false;
+    }
+
+    size_t stack_pos = 0;
+
+    // Execute the code
+    for (size_t pc = start; pc < end; pc++) {
+        char instruction = code[pc];
+
+        if (!tracing && config->breakpoint_count > 0 && is_breakpoint(config, pc)) {
+            printf("\n[DEBUG] Breakpoint at position %zu\n", pc);
+            tracing = true;
+        }
+        if (tracing) {
+            print_debug_state(memory, ptr, config->memory_size, pc, instruction);
+        }
+
+        switch (instruction) {
+        case '>': // Increment data pointer
+            if (config->wrap_memory) {
+                ptr = (ptr == memory + config->memory_size - 1) ? memory : ptr + 1;
+            }
+            else if (ptr < memory + config->memory_size - 1) {
+                ptr++;
+            }
+            else {
+                fprintf(stderr, "Error: Data pointer out of bounds at position %zu\n", pc);
+                free(loop_stack);
+                return false;
+            }
+            break;
+
+        case '<': // Decrement data pointer
+            if (config->wrap_memory) {
+                ptr = (ptr == memory) ? memory + config->memory_size - 1 : ptr - 1;
+            }
+            else if (ptr > memory) {
+                ptr--;
+            }
+            else {
+                fprintf(stderr, "Error: Data pointer out of bounds at position %zu\n", pc);
+                free(loop_stack);
+                return false;
+            }
+            break;
+
+        case '+': // Increment value at data pointer
+            (*ptr)++;
+            break;
+
+        case '-': // Decrement value at data pointer
+            (*ptr)--;
+            break;
+
+        case '.': // Output value at data pointer
+            putchar(*ptr);
+            fflush(stdout);
+            break;
+
+        case ',': // Input value and store at data pointer
+            read_input(input, ptr, config->eof_behavior);
+            break;
+
+        case '[': // Start of loop
+            if (*ptr == 0) {
+                // Skip to matching ']' (brackets were already validated by scan_loops)
+                size_t nest_level = 1;
+                while (nest_level > 0) {
+                    pc++;
+                    if (code[pc] == '[') {
+                        nest_level++;
+                    }
+                    else if (code[pc] == ']') {
+                        nest_level--;
+                    }
+                }
+            }
+            else {
+                // Push current position onto stack
+                if (stack_pos >= MAX_NESTED_LOOPS) {
+                    fprintf(stderr, "Error: Too many nested loops (max %d)\n", MAX_NESTED_LOOPS);
+                    free(loop_stack);
+                    return false;
+                }
+                loop_stack[stack_pos++] = pc;
+            }
+            break;
+
+        case ']': // End of loop
+            if (*ptr != 0) {
+                // Jump back to matching '[', finding it first if the range started inside the loop
+                if (stack_pos == 0) {
+                    size_t nest_level = 1;
+                    size_t open = pc;
+                    while (nest_level > 0) {
+                        open--;
+                        if (code[open] == ']') {
+                            nest_level++;
+                        }
+                        else if (code[open] == '[') {
+                            nest_level--;
+                        }
+                    }
+                    loop_stack[stack_pos++] = open;
+                }
+                pc = loop_stack[stack_pos - 1];
+            }
+            else if (stack_pos > 0) {
+                // Exit the loop
+                stack_pos--;
+            }
+            break;
+        }
+    }
+
+    free(loop_stack);
+    *ptr_io = ptr;
+    return true;
+}
+
+// Debug mode and breakpoints: execute the cleaned source one character at a time
+void execute_debug(char* code, BrainfuckConfig config) {
+    // Allocate memory for the tape
+    unsigned char* memory = (unsigned char*)calloc(config.memory_size, sizeof(unsigned char));
+    if (!memory) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return;
+    }
+
+    unsigned char* ptr = memory;
+    InputBuffer input = { .pos = 0, .size = 0 };
+    execute_range(code, 0, strlen(code), memory, &ptr, &config, &input);
+
+    // Free the allocated memory
+    free(memory);
+}
+
+void free_trace(Trace* trace) {
+    if (trace) {
+        free(trace->block.code);
+        free(trace->exits);
+        free(trace->frames);
+        free(trace);
+    }
+}
+
+// Append a guard to a trace being recorded. The exit resumes at bytecode index pc of
+// the block starting at start, inside the frames recorded from index first up to
+// depth, which begin at the traced loop body.
+bool trace_guard(Trace* trace, OpCode op, const Frame* frames, size_t first, size_t depth,
+    size_t pc, size_t start, LoopInfo* loop, size_t shift) {
+    size_t needed = trace->frame_count + (depth - first) + 1;
+    if (needed > trace->frame_capacity) {
+        size_t new_capacity = trace->frame_capacity ? trace->frame_capacity * 2 : 64;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        Frame* grown = (Frame*)realloc(trace->frames, new_capacity * sizeof(Frame));
+        if (!grown) {
+            return false;
+        }
+        trace->frames = grown;
+        trace->frame_capacity = new_capacity;
+    }
+    if (trace->exit_count == trace->exit_capacity) {
+        size_t new_capacity = trace->exit_capacity ? trace->exit_capacity * 2 : 16;
+        TraceExit* grown = (TraceExit*)realloc(trace->exits, new_capacity * sizeof(TraceExit));
+        if (!grown) {
+            return false;
+        }
+        trace->exits = grown;
+        trace->exit_capacity = new_capacity;
+    }
+
+    TraceExit* exit = &trace->exits[trace->exit_count];
+    exit->first_frame = trace->frame_count;
+    exit->frame_count = (depth - first) + 1;
+    for (size_t i = first; i < depth; i++) {
+        trace->frames[trace->frame_count++] = frames[i];
+    }
+    trace->frames[trace->frame_count].pc = pc;
+    trace->frames[trace->frame_count].start = start;
+    trace->frames[trace->frame_count].loop = loop;
+    trace->frames[trace->frame_count].shift = shift;
+    trace->frame_count++;
+
+    Instruction guard = { .op = op, .arg = (int)trace->exit_count++ };
+    return emit_instruction(&trace->block, &trace->code_capacity, guard);
+}
+
+bool fits_int16(long long value) {
+    return value >= -32768 && value <= 32767;
+}
+
+// Whether an instruction's operands need extension words
+bool encoded_wide(const Instruction* instruction) {
+    switch (instruction->op) {
+    case OP_ADD:
+    case OP_ADD_VECTOR:
+    case OP_MUL:
+    case OP_CLEAR:
+    case OP_SET:
+    case OP_OUTPUT:
+    case OP_INPUT:
+        return !fits_int16(instruction->offset);
+    case OP_MOVE:
+        return instruction->arg < -(1 << 23) || instruction->arg >= (1 << 23);
+    case OP_BOUNDS:
+        return instruction->offset < -128 || instruction->offset > 127 ||
+            instruction->arg < 0 || instruction->arg > 65535;
+    default:
+        return false;
+    }
+}
+
+// Number of bytecode words an instruction encodes to
+size_t encoded_size(const Instruction* instruction) {
+    size_t extension = encoded_wide(instruction) ? 1 : 0;
+    switch (instruction->op) {
+    case OP_ADD_VECTOR:
+    case OP_MUL:
+        return 2 + extension;
+    case OP_BOUNDS:
+        return 2 + 2 * extension;
+    case OP_LOOP:
+    case OP_IF:
+        return 2;
+    case OP_GUARD_BOUNDS:
+        return 3;
+    default:
+        return 1 + extension;
+    }
+}
+
+bool bytecode_word(Bytecode* bytecode, uint32_t word) {
+    if (bytecode->length == bytecode->capacity) {
+        size_t new_capacity = bytecode->capacity ? bytecode->capacity * 2 : 1024;
+        uint32_t* grown = (uint32_t*)realloc(bytecode->words, new_capacity * sizeof(uint32_t));
+        if (!grown) {
+            return false;
+        }
+        bytecode->words = grown;
+        bytecode->capacity = new_capacity;
+    }
+    bytecode->words[bytecode->length++] = word;
+    return true;
+}
+
+// Opcode word with an 8-bit operand and a 16-bit operand
+uint32_t bytecode_pack(int op, int small, int offset) {
+    return (uint32_t)op | ((uint32_t)(small & 0xFF) << 8) | ((uint32_t)(offset & 0xFFFF) << 16);
+}
+
+// Append the bytecode of one instruction. skip is the word count to the end of the
+// segment for OP_BOUNDS, or to the branch target for OP_IF.
+bool encode_instruction(Bytecode* bytecode, const Instruction* instruction, size_t skip) {
+    bool narrow = !encoded_wide(instruction);
+    int op = narrow ? instruction->op : (instruction->op | OP_WIDE);
+    bool ok = true;
+
+    switch (instruction->op) {
+    case OP_ADD:
+    case OP_CLEAR:
+    case OP_SET:
+    case OP_OUTPUT:
+    case OP_INPUT:
+        ok = bytecode_word(bytecode, bytecode_pack(op, instruction->arg, narrow ? instruction->offset : 0));
+        if (!narrow) {
+            ok = ok && bytecode_word(bytecode, (uint32_t)instruction->offset);
+        }
+        break;
+
+    case OP_ADD_VECTOR:
+    case OP_MUL:
+        ok = bytecode_word(bytecode, bytecode_pack(op, instruction->arg, narrow ? instruction->offset : 0));
+        if (!narrow) {
+            ok = ok && bytecode_word(bytecode, (uint32_t)instruction->offset);
+        }
+        ok = ok && bytecode_word(bytecode, (uint32_t)instruction->arg2);
+        break;
+
+    case OP_MOVE:
+        if (narrow) {
+            ok = bytecode_word(bytecode, (uint32_t)op | ((uint32_t)instruction->arg << 8));
+        }
+        else {
+            ok = bytecode_word(bytecode, (uint32_t)op) && bytecode_word(bytecode, (uint32_t)instruction->arg);
+        }
+        break;
+
+    case OP_BOUNDS: {
+        // The source range is only needed on the slow path, so it is kept out of line
+        if (bytecode->segment_count == bytecode->segment_capacity) {
+            size_t new_capacity = bytecode->segment_capacity ? bytecode->segment_capacity * 2 : 64;
+            SegmentInfo* grown = (SegmentInfo*)realloc(bytecode->segments, new_capacity * sizeof(SegmentInfo));
+            if (!grown) {
+                return false;
+            }
+            bytecode->segments = grown;
+            bytecode->segment_capacity = new_capacity;
+        }
+        SegmentInfo* segment = &bytecode->segments[bytecode->segment_count];
+        segment->pos = instruction->pos;
+        segment->length = (size_t)instruction->arg2;
+        segment->skip = skip;
+        if (narrow) {
+            ok = bytecode_word(bytecode, bytecode_pack(op, instruction->offset, instruction->arg));
+        }
+        else {
+            ok = bytecode_word(bytecode, (uint32_t)op) &&
+                bytecode_word(bytecode, (uint32_t)instruction->offset) &&
+                bytecode_word(bytecode, (uint32_t)instruction->arg);
+        }
+        ok = ok && bytecode_word(bytecode, (uint32_t)bytecode->segment_count++);
+        break;
+    }
+
+    case OP_LOOP:
+        ok = bytecode_word(bytecode, (uint32_t)op) && bytecode_word(bytecode, (uint32_t)instruction->arg);
+        break;
+
+    case OP_IF:
+        ok = bytecode_word(bytecode, (uint32_t)op) && bytecode_word(bytecode, (uint32_t)skip);
+        break;
+
+    case OP_GUARD_BOUNDS:
+        ok = bytecode_word(bytecode, (uint32_t)op | ((uint32_t)instruction->arg2 << 8)) &&
+            bytecode_word(bytecode, (uint32_t)instruction->offset) &&
+            bytecode_word(bytecode, (uint32_t)instruction->arg);
+        break;
+
+    default:
+        ok = bytecode_word(bytecode, (uint32_t)op | ((uint32_t)instruction->arg << 8));
+        break;
+    }
+    return ok;
+}
+
+// Decode the instruction at pc, or the first part of a superinstruction. Returns its size in words.
+size_t decode_instruction(const uint32_t* pc, Instruction* instruction) {
+    uint32_t word = pc[0];
+    int op = (int)(word & 0xFF);
+    bool wide = (op & OP_WIDE) != 0;
+    instruction->op = (OpCode)(op & ~OP_WIDE);
+    for (size_t i = 0; i < SUPERINSTRUCTION_COUNT; i++) {
+        if (instruction->op == superinstructions[i].fused) {
+            instruction->op = superinstructions[i].first;
+        }
+    }
+    instruction->arg = (int)((word >> 8) & 0xFF);
+    instruction->offset = wide ? (int32_t)pc[1] : (int32_t)word >> 16;
+    instruction->arg2 = 0;
+    instruction->pos = 0;
+
+    switch (instruction->op) {
+    case OP_ADD:
+    case OP_CLEAR:
+    case OP_SET:
+    case OP_OUTPUT:
+    case OP_INPUT:
+        return wide ? 2 : 1;
+    case OP_ADD_VECTOR:
+    case OP_MUL:
+        instruction->arg2 = (int32_t)pc[wide ? 2 : 1];
+        return wide ? 3 : 2;
+    case OP_MOVE:
+        instruction->offset = 0;
+        instruction->arg = wide ? (int32_t)pc[1] : (int32_t)word >> 8;
+        return wide ? 2 : 1;
+    case OP_BOUNDS:
+        instruction->offset = wide ? (int32_t)pc[1] : (int8_t)(word >> 8);
+        instruction->arg = wide ? (int32_t)pc[2] : (int)(word >> 16);
+        return wide ? 4 : 2;
+    case OP_LOOP:
+    case OP_IF:
+        instruction->offset = 0;
+        instruction->arg = (int)pc[1];
+        return 2;
+    default:
+        instruction->offset = 0;
+        instruction->arg = (int)(word >> 8);
+        return 1;
+    }
+}
+
+// Append a block to the bytecode, terminated by end_op. Returns the index of its
+// first word, or SIZE_MAX when out of memory.
+size_t encode_block(Bytecode* bytecode, const Block* block, OpCode end_op) {
+    // Word offset of every instruction, to find where each segment ends
+    size_t* offsets = (size_t*)malloc((block->length + 1) * sizeof(size_t));
+    if (!offsets) {
+        return SIZE_MAX;
+    }
+    offsets[0] = 0;
+    for (size_t ip = 0; ip < block->length; ip++) {
+        offsets[ip + 1] = offsets[ip] + encoded_size(&block->code[ip]);
+    }
+
+    // Instructions reached by the slow path of a bounds check or by a branch
+    bool* targets = (bool*)calloc(block->length + 1, sizeof(bool));
+    if (!targets) {
+        free(offsets);
+        return SIZE_MAX;
+    }
+
+    size_t start = bytecode->length;
+    bool ok = true;
+    for (size_t ip = 0; ok && ip < block->length; ip++) {
+        const Instruction* instruction = &block->code[ip];
+        size_t skip = 0;
+        if (instruction->op == OP_BOUNDS) {
+            size_t end = instruction->pos + (size_t)instruction->arg2;
+            size_t next = ip + 1;
+            while (next < block->length && block->code[next].pos < end) {
+                next++;
+            }
+            skip = offsets[next] - offsets[ip];
+            targets[next] = true;
+        }
+        else if (instruction->op == OP_IF) {
+            size_t next = ip + 1 + (size_t)instruction->arg;
+            skip = offsets[next] - offsets[ip];
+            targets[next] = true;
+        }
+        ok = encode_instruction(bytecode, instruction, skip);
+    }
+    ok = ok && bytecode_word(bytecode, (uint32_t)end_op);
+
+    // Greedily fuse pairs of narrow instructions into superinstructions, unless the
+    // second one can be jumped to on its own
+    for (size_t ip = 0; ok && ip + 1 < block->length; ip++) {
+        const Instruction* first = &block->code[ip];
+        const Instruction* second = &block->code[ip + 1];
+        if (targets[ip + 1] || encoded_wide(first) || encoded_wide(second)) {
+            continue;
+        }
+        for (size_t i = 0; i < SUPERINSTRUCTION_COUNT; i++) {
+            if (first->op == superinstructions[i].first && second->op == superinstructions[i].second) {
+                uint32_t* word = &bytecode->words[start + offsets[ip]];
+                *word = (*word & ~0xFFu) | (uint32_t)superinstructions[i].fused;
+                ip++;
+                break;
+            }
+        }
+    }
+    free(targets);
+    free(offsets);
+    return ok ? start : SIZE_MAX;
+}
+
+// Compile a loop body and append it to the bytecode
+bool compile_loop(const char* code, LoopInfo* loops, size_t index, Bytecode* bytecode, bool wrap) {
+    LoopInfo* loop = &loops[index];
+    if (loop->shared != index) {
+        // Same source as an earlier loop: run that loop's body
+        LoopInfo* shared = &loops[loop->shared];
+        if (shared->entry == SIZE_MAX && !compile_loop(code, loops, loop->shared, bytecode, wrap)) {
+            return false;
+        }
+        loop->entry = shared->entry;
+        loop->has_inner_loops = shared->has_inner_loops;
+        return true;
+    }
+    Block* body = compile_block(code, loop->open + 1, loop->close, loops, index + 1, &bytecode->constants, wrap);
+    if (!body) {
+        return false;
+    }
+    for (size_t i = 0; i < body->length; i++) {
+        if (body->code[i].op == OP_LOOP) {
+            loop->has_inner_loops = true;
+        }
+    }
+    loop->entry = encode_block(bytecode, body, OP_END);
+    free_block(body);
+    if (loop->entry == SIZE_MAX) {
+        fprintf(stderr, "Error: Memory allocation failed while compiling\n");
+        return false;
+    }
+    return true;
+}
+
+// Compile a hot loop body again at the end of the bytecode, next to the traces and
+// other hot bodies and away from the initialization code that was compiled first
+bool move_loop_to_hot(const char* code, LoopInfo* loops, LoopInfo* loop, Bytecode* bytecode, bool wrap) {
+    LoopInfo* shared = &loops[loop->shared];
+    if (!shared->hot) {
+        Block* body = compile_block(code, shared->open + 1, shared->close, loops, loop->shared + 1, &bytecode->constants, wrap);
+        if (!body) {
+            return false;
+        }
+        size_t entry = encode_block(bytecode, body, OP_END);
+        free_block(body);
+        if (entry == SIZE_MAX) {
+            fprintf(stderr, "Error: Memory allocation failed while compiling\n");
+            return false;
+        }
+        shared->entry = entry;
+        shared->hot = true;
+    }
+    loop->entry = shared->entry;
+    return true;
+}
+
+// Add count constants to neighbouring cells, eight cells at a time: the low seven bits
+// of every byte are added separately from the top bit so carries stay within each cell
+void add_cells(unsigned char* cells, const unsigned char* values, size_t count) {
+    const uint64_t low_bits = 0x7F7F7F7F7F7F7F7FULL;
+    const uint64_t high_bits = 0x8080808080808080ULL;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint64_t a;
+        uint64_t b;
+        memcpy(&a, cells + i, 8);
+        memcpy(&b, values + i, 8);
+        uint64_t sum = ((a & low_bits) + (b & low_bits)) ^ ((a ^ b) & high_bits);
+        memcpy(cells + i, &sum, 8);
+    }
+    for (; i < count; i++) {
+        cells[i] += values[i];
+    }
+}
+
+// Classify a loop as strided: its body has no inner loops or I/O and moves the pointer
+// by a non-zero amount, so every iteration adds the same values at the same offsets
+// from its loop cell and then moves on by that stride
+bool strided_loop(const char* code, const LoopInfo* loop, StridedLoop* strided) {
+    memset(strided, 0, sizeof(*strided));
+    int offset = 0;
+    for (size_t pos = loop->open + 1; pos < loop->close; pos++) {
+        switch (code[pos]) {
+        case '>':
+            offset++;
+            break;
+        case '<':
+            offset--;
+            break;
+        case '+':
+        case '-': {
+            int i = 0;
+            while (i < strided->target_count && strided->offsets[i] != offset) {
+                i++;
+            }
+            if (i == strided->target_count) {
+                if (i == MAX_STRIDE_TARGETS) {
+                    return false;
+                }
+                strided->offsets[i] = offset;
+                strided->values[i] = 0;
+                strided->target_count++;
+            }
+            strided->values[i] += (code[pos] == '+') ? 1 : 255;
+            break;
+        }
+        case '[':
+        case ']':
+        case '.':
+        case ',':
+            return false;
+        }
+        if (offset < strided->low) {
+            strided->low = offset;
+        }
+        if (offset > strided->high) {
+            strided->high = offset;
+        }
+        if (strided->high - strided->low > MAX_SIMPLE_LOOP) {
+            return false;
+        }
+    }
+    if (offset == 0) {
+        return false;
+    }
+
+    // Additions that cancel out are dropped; an addition at a later loop cell
+    // makes each iteration depend on the one before
+    int kept = 0;
+    strided->independent = true;
+    for (int i = 0; i < strided->target_count; i++) {
+        int target = strided->offsets[i];
+        if (strided->values[i] == 0) {
+            continue;
+        }
+        if (target != 0 && target % offset == 0 && target / offset > 0) {
+            strided->independent = false;
+        }
+        strided->offsets[kept] = target;
+        strided->values[kept++] = strided->values[i];
+    }
+    strided->target_count = kept;
+    strided->stride = offset;
+    return true;
+}
+
+// Run a strided loop entered with its cell non-zero, for as many iterations as stay on
+// the tape. An independent loop first finds its trip count from the cells it tests,
+// with memchr for a stride of 1, then does each of its additions for all iterations
+// at once. Returns the iterations run; if the loop cell is still non-zero afterwards,
+// the next iteration would leave the tape and the rest must run from source.
+unsigned long long run_strided_loop(const StridedLoop* strided, unsigned char* memory,
+    size_t memory_size, unsigned char** ptr_io) {
+    unsigned char* ptr = *ptr_io;
+    long long cell = (long long)(ptr - memory);
+    long long stride = strided->stride;
+    if (cell + strided->low < 0 || cell + strided->high >= (long long)memory_size) {
+        return 0;
+    }
+    long long room = (stride > 0) ? ((long long)memory_size - 1 - strided->high - cell) / stride + 1 :
+        (cell + strided->low) / -stride + 1;
+
+    long long trips = 0;
+    if (strided->independent) {
+        if (stride == 1) {
+            unsigned char* zero = (unsigned char*)memchr(ptr, 0, (size_t)room);
+            trips = zero ? zero - ptr : room;
+        }
+        else {
+            for (unsigned char* test = ptr; trips < room && *test != 0; test += stride) {
+                trips++;
+            }
+        }
+        for (int i = 0; i < strided->target_count; i++) {
+            unsigned char* target = ptr + strided->offsets[i];
+            unsigned char value = strided->values[i];
+            if (stride == 1) {
+                for (long long k = 0; k < trips; k++) {
+                    target[k] += value;
+                }
+            }
+            else {
+                for (long long k = 0; k < trips; k++) {
+                    target[k * stride] += value;
+                }
+            }
+        }
+        ptr += trips * stride;
+    }
+    else {
+        while (trips < room && *ptr != 0) {
+            for (int i = 0; i < strided->target_count; i++) {
+                ptr[strided->offsets[i]] += strided->values[i];
+            }
+            ptr += stride;
+            trips++;
+        }
+    }
+    *ptr_io = ptr;
+    return (unsigned long long)trips;
+}
+
+// Find the cells a loop can touch. Memoizable loops do no I/O and every loop in them,
+// themselves included, returns the pointer to where it started each iteration, so the
+// cells they read and write are fixed offsets from the pointer at loop entry.
+bool memo_window(const char* code, const LoopInfo* loop, int* low, int* high) {
+    int offsets[MAX_NESTED_LOOPS];
+    size_t open = 0;
+    int offset = 0;
+    *low = 0;
+    *high = 0;
+    for (size_t pos = loop->open + 1; pos < loop->close; pos++) {
+        switch (code[pos]) {
+        case '>':
+            offset++;
+            break;
+        case '<':
+            offset--;
+            break;
+        case '[':
+            offsets[open++] = offset;
+            break;
+        case ']':
+            if (offsets[--open] != offset) {
+                return false;
+            }
+            break;
+        case '.':
+        case ',':
+            return false;
+        }
+        if (offset < *low) {
+            *low = offset;
+        }
+        if (offset > *high) {
+            *high = offset;
+        }
+        if (*high - *low >= MAX_MEMO_WINDOW) {
+            return false;
+        }
+    }
+    return offset == 0;
+}
+
+// Results of memoized loops, keyed by loop and the window contents on entry
+typedef struct {
+    size_t loop;  // Loop table index + 1, 0 for an unused slot
+    unsigned char input[MAX_MEMO_WINDOW];
+    unsigned char output[MAX_MEMO_WINDOW];
+} MemoEntry;
+
+typedef struct {
+    MemoEntry* entries;
+    LoopInfo* pending;    // Loop whose result is recorded when it exits, NULL if none
+    size_t pending_depth; // Frame depth outside that loop
+    size_t pending_slot;
+    unsigned char pending_input[MAX_MEMO_WINDOW];
+    unsigned long long lookups;
+    unsigned long long hits;
+    unsigned int loops_disabled;
+} MemoTable;
+
+size_t memo_slot(size_t loop, const unsigned char* window, size_t width) {
+    // FNV-1a
+    uint32_t hash = 2166136261u ^ (uint32_t)loop;
+    for (size_t i = 0; i < width; i++) {
+        hash = (hash ^ window[i]) * 16777619u;
+    }
+    return hash % MEMO_TABLE_SIZE;
+}
+
+// The pending loop has exited with the pointer back at ptr: store its result
+void memo_store(MemoTable* memo, const LoopInfo* loops, const unsigned char* ptr) {
+    const LoopInfo* loop = memo->pending;
+    size_t width = (size_t)(loop->memo_high - loop->memo_low + 1);
+    MemoEntry* entry = &memo->entries[memo->pending_slot];
+    entry->loop = (size_t)(loop - loops) + 1;
+    memcpy(entry->input, memo->pending_input, width);
+    memcpy(entry->output, ptr + loop->memo_low, width);
+    memo->pending = NULL;
+}
+
+// Loop rewriting. A loop that does no I/O and keeps its pointer in a small window (see
+// memo_window) only reads the cells that it and its inner loops test; every other cell
+// of the window just has constants added to it each iteration. --superoptimize runs such
+// a loop for every value of those input cells and looks for a short MUL, CLEAR and ADD
+// sequence that leaves the window the same for all of them.
+
+// Cells the loop tests, as offsets from the loop cell. Returns their count, or -1 if
+// there are more than MAX_REWRITE_INPUTS.
+int rewrite_inputs(const char* code, const LoopInfo* loop, int* inputs) {
+    int count = 0;
+    int offset = 0;
+    for (size_t pos = loop->open; pos < loop->close; pos++) {
+        if (code[pos] == '>') {
+            offset++;
+        }
+        else if (code[pos] == '<') {
+            offset--;
+        }
+        else if (code[pos] == '[') {
+            int i = 0;
+            while (i < count && inputs[i] != offset) {
+                i++;
+            }
+            if (i == count) {
+                if (count == MAX_REWRITE_INPUTS) {
+                    return -1;
+                }
+                inputs[count++] = offset;
+            }
+        }
+    }
+    return count;
+}
+
+bool is_rewrite_input(const int* inputs, int input_count, int offset) {
+    for (int i = 0; i < input_count; i++) {
+        if (inputs[i] == offset) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Set the input cells to the bytes of value, the first input from the lowest byte
+void set_rewrite_inputs(unsigned char* cell, const int* inputs, int input_count, size_t value) {
+    for (int i = 0; i < input_count; i++) {
+        cell[inputs[i]] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+// Run the loop with the pointer at cell, using up to *steps steps. Returns false if it
+// did not finish in time.
+bool run_rewrite_loop(const char* code, const LoopInfo* loop, unsigned char* cell, unsigned long long* steps) {
+    for (size_t pos = loop->open; pos <= loop->close; pos++) {
+        if (*steps == 0) {
+            return false;
+        }
+        (*steps)--;
+        switch (code[pos]) {
+        case '+':
+            (*cell)++;
+            break;
+        case '-':
+            (*cell)--;
+            break;
+        case '>':
+            cell++;
+            break;
+        case '<':
+            cell--;
+            break;
+        case '[':
+            for (int depth = (*cell == 0); depth > 0;) {
+                pos++;
+                depth += (code[pos] == '[') - (code[pos] == ']');
+            }
+            break;
+        case ']':
+            for (int depth = (*cell != 0); depth > 0;) {
+                pos--;
+                depth += (code[pos] == ']') - (code[pos] == '[');
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+void apply_rewrite(const Rewrite* rewrite, unsigned char* cell) {
+    for (int i = 0; i < rewrite->length; i++) {
+        const Instruction* instruction = &rewrite->code[i];
+        switch (instruction->op) {
+        case OP_MUL:
+            cell[instruction->offset] += (unsigned char)(cell[instruction->arg2] * instruction->arg);
+            break;
+        case OP_CLEAR:
+            cell[instruction->offset] = 0;
+            break;
+        default:
+            cell[instruction->offset] += (unsigned char)instruction->arg;
+            break;
+        }
+    }
+}
+
+// Run the loop with the given input values and the rest of its window at 0. Returns
+// false if it did not finish in time.
+bool run_rewrite_case(const char* code, const LoopInfo* loop, int low, int high, const int* inputs,
+    int input_count, size_t value, unsigned char* window, unsigned long long* steps) {
+    memset(window, 0, (size_t)(high - low + 1));
+    set_rewrite_inputs(window - low, inputs, input_count, value);
+    return run_rewrite_loop(code, loop, window - low, steps);
+}
+
+// Check a rewrite against the loop for every value of its inputs
+bool rewrite_matches(const char* code, const LoopInfo* loop, const Rewrite* rewrite, const int* inputs,
+    int input_count) {
+    // Cells other than the inputs are 0 in the check but may hold anything, so only
+    // multiples of the inputs may be added to them
+    for (int i = 0; i < rewrite->length; i++) {
+        const Instruction* instruction = &rewrite->code[i];
+        if (instruction->offset < rewrite->low || instruction->offset > rewrite->high ||
+            (instruction->op == OP_MUL && !is_rewrite_input(inputs, input_count, instruction->arg2)) ||
+            (instruction->op == OP_CLEAR && !is_rewrite_input(inputs, input_count, instruction->offset))) {
+            return false;
+        }
+    }
+
+    size_t width = (size_t)(rewrite->high - rewrite->low + 1);
+    size_t cases = (size_t)1 << (8 * input_count);
+    unsigned char expected[MAX_MEMO_WINDOW];
+    unsigned char window[MAX_MEMO_WINDOW];
+    unsigned long long steps = MAX_SUPER_STEPS;
+    for (size_t value = 0; value < cases; value++) {
+        if (!run_rewrite_case(code, loop, rewrite->low, rewrite->high, inputs, input_count, value, expected, &steps)) {
+            return false;
+        }
+        memset(window, 0, width);
+        set_rewrite_inputs(window - rewrite->low, inputs, input_count, value);
+        apply_rewrite(rewrite, window - rewrite->low);
+        if (memcmp(window, expected, width) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool add_rewrite_op(Rewrite* rewrite, OpCode op, int arg, int offset, int source) {
+    if (rewrite->length == MAX_REWRITE_OPS) {
+        return false;
+    }
+    rewrite->code[rewrite->length++] = (Instruction){ .op = op, .arg = arg & 0xFF, .offset = offset, .arg2 = source };
+    return true;
+}
+
+// Search for a rewrite of the loop that adds a multiple of each input to every cell,
+// clearing or scaling the inputs themselves. The multiples are what the loop leaves
+// with one input at 1 and the others at 0; the exhaustive check then rejects loops
+// that are not linear in their inputs or would read an input after changing it. There
+// is one candidate per rotation of the order the inputs are updated in, and the first
+// that passes is kept: this is not a search for the cheapest sequence, and code outside
+// loops is never rewritten.
+bool superoptimize_loop(const char* code, const LoopInfo* loop, Rewrite* rewrite) {
+    int low;
+    int high;
+    int inputs[MAX_REWRITE_INPUTS];
+    int input_count;
+    if (loop->close - loop->open > MAX_SIMPLE_LOOP || !memo_window(code, loop, &low, &high) ||
+        (input_count = rewrite_inputs(code, loop, inputs)) < 0) {
+        return false;
+    }
+    unsigned char units[MAX_REWRITE_INPUTS][MAX_MEMO_WINDOW];
+    unsigned long long steps = MAX_SUPER_STEPS;
+    for (int i = 0; i < input_count; i++) {
+        if (!run_rewrite_case(code, loop, low, high, inputs, input_count, (size_t)1 << (8 * i), units[i], &steps)) {
+            return false;
+        }
+    }
+
+    for (int first = 0; first < input_count; first++) {
+        *rewrite = (Rewrite){ .low = low, .high = high };
+        bool fits = true;
+        for (int offset = low; offset <= high; offset++) {
+            if (is_rewrite_input(inputs, input_count, offset)) {
+                continue;
+            }
+            for (int i = 0; i < input_count; i++) {
+                int factor = units[i][offset - low];
+                if (factor != 0) {
+                    fits = fits && add_rewrite_op(rewrite, OP_MUL, factor, offset, inputs[i]);
+                }
+            }
+        }
+        // Inputs last, in every rotation of their order
+        for (int k = 0; k < input_count; k++) {
+            int target = inputs[(first + k) % input_count];
+            for (int i = 0; i < input_count; i++) {
+                int factor = units[i][target - low];
+                if (inputs[i] != target) {
+                    if (factor != 0) {
+                        fits = fits && add_rewrite_op(rewrite, OP_MUL, factor, target, inputs[i]);
+                    }
+                }
+                else if (factor == 0) {
+                    fits = fits && add_rewrite_op(rewrite, OP_CLEAR, 0, target, 0);
+                }
+                else if (factor != 1) {
+                    fits = fits && add_rewrite_op(rewrite, OP_MUL, factor - 1, target, target);
+                }
+            }
+        }
+        if (fits && rewrite_matches(code, loop, rewrite, inputs, input_count)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Check a rewrite read from a database against the loop it is meant for
+bool verify_rewrite(const char* code, const LoopInfo* loop, Rewrite* rewrite) {
+    int inputs[MAX_REWRITE_INPUTS];
+    int input_count;
+    return loop->close - loop->open <= MAX_SIMPLE_LOOP && memo_window(code, loop, &rewrite->low, &rewrite->high) &&
+        (input_count = rewrite_inputs(code, loop, inputs)) >= 0 && rewrite_matches(code, loop, rewrite, inputs, input_count);
+}
+
+// Rewrite database lines are a loop's text followed by its instructions:
+// mul:<target>:<source>:<factor>, clear:<target> and add:<target>:<value>
+void write_rewrite(FILE* file, const char* code, const LoopInfo* loop, const Rewrite* rewrite) {
+    fprintf(file, "%.*s", (int)(loop->close - loop->open + 1), code + loop->open);
+    for (int i = 0; i < rewrite->length; i++) {
+        const Instruction* instruction = &rewrite->code[i];
+        if (instruction->op == OP_MUL) {
+            fprintf(file, " mul:%d:%d:%d", instruction->offset, instruction->arg2, instruction->arg);
+        }
+        else if (instruction->op == OP_CLEAR) {
+            fprintf(file, " clear:%d", instruction->offset);
+        }
+        else {
+            fprintf(file, " add:%d:%d", instruction->offset, instruction->arg);
+        }
+    }
+    fprintf(file, "\n");
+}
+
+// Parse the instructions after the loop text of a database line
+bool parse_rewrite(const char* text, Rewrite* rewrite) {
+    *rewrite = (Rewrite){ 0 };
+    while (*text == ' ') {
+        int offset;
+        int source;
+        int value;
+        int used = 0;
+        bool parsed;
+        if (sscanf(text, " mul:%d:%d:%d%n", &offset, &source, &value, &used) == 3) {
+            parsed = add_rewrite_op(rewrite, OP_MUL, value, offset, source);
+        }
+        else if (sscanf(text, " clear:%d%n", &offset, &used) == 1) {
+            parsed = add_rewrite_op(rewrite, OP_CLEAR, 0, offset, 0);
+        }
+        else if (sscanf(text, " add:%d:%d%n", &offset, &value, &used) == 2) {
+            parsed = add_rewrite_op(rewrite, OP_ADD, value, offset, 0);
+        }
+        else {
+            return false;
+        }
+        if (!parsed) {
+            return false;
+        }
+        text += used;
+    }
+    return *text == '\n' || *text == '\0';
+}
+
+// Length of the loop text at the start of a database line
+size_t rewrite_key_length(const char* line) {
+    size_t length = 0;
+    while (line[length] && line[length] != ' ' && line[length] != '\n') {
+        length++;
+    }
+    return length;
+}
+
+// Index the loops that are compiled, the ones find_shared_loops left pointing at
+// themselves, by the hash of their text, so database lines are looked up without
+// scanning every loop
+bool index_rewrite_loops(LoopTable* table, const LoopInfo* loops, size_t loop_count) {
+    if (!loop_table_init(table, loop_count)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return false;
+    }
+    for (size_t i = 0; i < loop_count; i++) {
+        if (loops[i].shared == i) {
+            size_t slot = loops[i].hash & (table->size - 1);
+            while (table->slots[slot] != SIZE_MAX) {
+                slot = (slot + 1) & (table->size - 1);
+            }
+            table->slots[slot] = i;
+        }
+    }
+    return true;
+}
+
+// Loop with the given text if it has no rewrite yet, or loop_count if there is none
+size_t find_rewrite_loop(const LoopTable* table, const char* code, const LoopInfo* loops, size_t loop_count,
+    const char* text, size_t length) {
+    uint32_t hash;
+    if (!text_loop_hash(text, length, &hash)) {
+        return loop_count;
+    }
+    for (size_t slot = hash & (table->size - 1); table->slots[slot] != SIZE_MAX; slot = (slot + 1) & (table->size - 1)) {
+        const LoopInfo* loop = &loops[table->slots[slot]];
+        if (loop->hash == hash && loop->close - loop->open + 1 == length && memcmp(code + loop->open, text, length) == 0) {
+            return loop->rewrite ? loop_count : table->slots[slot];
+        }
+    }
+    return loop_count;
+}
+
+// Load the rewrites for this program's loops from a database written by --superoptimize.
+// Each one is checked against its loop before use. Returns NULL on failure.
+Rewrite* load_rewrites(const char* path, const char* code, LoopInfo* loops, size_t loop_count) {
+    FILE* file = NULL;
+    errno_t err = fopen_s(&file, path, "r");
+    if (err != 0 || !file) {
+        fprintf(stderr, "Error: Could not open file %s\n", path);
+        return NULL;
+    }
+    int version = 0;
+    if (fscanf(file, "bf-rewrites %d\n", &version) != 1 || version != 1) {
+        fprintf(stderr, "Error: %s is not a rewrite database\n", path);
+        fclose(file);
+        return NULL;
+    }
+    Rewrite* rewrites = (Rewrite*)calloc(loop_count + 1, sizeof(Rewrite));
+    if (!rewrites) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        fclose(file);
+        return NULL;
+    }
+    LoopTable table;
+    if (!index_rewrite_loops(&table, loops, loop_count)) {
+        free(rewrites);
+        fclose(file);
+        return NULL;
+    }
+
+    char line[REWRITE_LINE_SIZE];
+    while (fgets(line, sizeof(line), file)) {
+        size_t length = rewrite_key_length(line);
+        size_t index = find_rewrite_loop(&table, code, loops, loop_count, line, length);
+        if (index == loop_count) {
+            continue;
+        }
+        if (!parse_rewrite(line + length, &rewrites[index])) {
+            fprintf(stderr, "Warning: Rewrite database %s is damaged; only its first rewrites are used\n", path);
+            break;
+        }
+        if (!verify_rewrite(code, &loops[index], &rewrites[index])) {
+            fprintf(stderr, "Warning: Rewrite in %s does not match the loop at %zu and is ignored\n", path, loops[index].open);
+            continue;
+        }
+        loops[index].rewrite = &rewrites[index];
+    }
+    free(table.slots);
+    fclose(file);
+    for (size_t i = 0; i < loop_count; i++) {
+        loops[i].rewrite = loops[loops[i].shared].rewrite;
+    }
+    return rewrites;
+}
+
+// Dynamic instruction counts collected with --profile
+typedef struct {
+    unsigned long long counts[OP_COUNT];
+    unsigned long long pairs[OP_COUNT * OP_COUNT];
+    unsigned long long triples[OP_COUNT * OP_COUNT * OP_COUNT];
+    int previous[2];  // Last two opcodes executed, -1 before there are any
+} Profile;
+
+void profile_count(Profile* profile, int op) {
+    // A superinstruction counts as its two parts, so the report shows which pairs run
+    // together before any of them are fused
+    for (size_t i = 0; i < SUPERINSTRUCTION_COUNT; i++) {
+        if (op == (int)superinstructions[i].fused) {
+            profile_count(profile, (int)superinstructions[i].first);
+            op = (int)superinstructions[i].second;
+            break;
+        }
+    }
+    profile->counts[op]++;
+    if (profile->previous[1] >= 0) {
+        profile->pairs[profile->previous[1] * OP_COUNT + op]++;
+        if (profile->previous[0] >= 0) {
+            profile->triples[(profile->previous[0] * OP_COUNT + profile->previous[1]) * OP_COUNT + op]++;
+        }
+    }
+    profile->previous[0] = profile->previous[1];
+    profile->previous[1] = op;
+}
+
+// Print the most frequent entries of a table of sequence counts of the given length
+void print_profile_table(const char* title, const unsigned long long* counts, size_t length,
+    unsigned long long total) {
+    size_t entries = 1;
+    for (size_t i = 0; i < length; i++) {
+        entries *= OP_COUNT;
+    }
+
+    fprintf(stderr, "%s\n", title);
+    unsigned long long previous_best = ULLONG_MAX;
+    size_t previous_index = 0;
+    for (int shown = 0; shown < 10; shown++) {
+        // Next entry in order of decreasing count, ties broken by index
+        size_t best_index = SIZE_MAX;
+        for (size_t i = 0; i < entries; i++) {
+            bool after_previous = counts[i] < previous_best ||
+                (counts[i] == previous_best && i > previous_index);
+            if (counts[i] > 0 && after_previous && (best_index == SIZE_MAX || counts[i] > counts[best_index])) {
+                best_index = i;
+            }
+        }
+        if (best_index == SIZE_MAX) {
+            break;
+        }
+
+        fprintf(stderr, "  %12llu  %5.1f%%  ", counts[best_index], 100.0 * counts[best_index] / total);
+        size_t divisor = entries / OP_COUNT;
+        for (size_t i = 0; i < length; i++) {
+            fprintf(stderr, "%s%s", i ? "; " : "", op_names[(best_index / divisor) % OP_COUNT]);
+            divisor /= OP_COUNT;
+        }
+        fprintf(stderr, "\n");
+        previous_best = counts[best_index];
+        previous_index = best_index;
+    }
+}
+
+void print_profile(const Profile* profile) {
+    unsigned long long total = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total += profile->counts[op];
+    }
+    fprintf(stderr, "\nProfile: %llu instructions executed\n", total);
+    if (total == 0) {
+        return;
+    }
+    print_profile_table("Instructions:", profile->counts, 1, total);
+    print_profile_table("Most frequent pairs:", profile->pairs, 2, total);
+    print_profile_table("Most frequent triples:", profile->triples, 3, total);
+}
+
+// Count the end of a profiled loop entry in its trip count histogram
+void profile_trip(LoopProfile* counts) {
+    unsigned long long trips = counts->iterations - counts->started;
+    int bucket = 0;
+    while (trips > 1 && bucket < TRIP_BUCKETS - 1) {
+        trips >>= 1;
+        bucket++;
+    }
+    counts->trips[bucket]++;
+}
+
+// Index of the copy of a loop that runs when its code runs at the given source shift.
+// Inner loops of a shared body are compiled with the indexes of the first copy, so a
+// later copy's inner loops are found by their position; loops are in source order.
+size_t profiled_loop(const LoopInfo* loops, size_t loop_count, const LoopInfo* loop, size_t shift) {
+    if (shift == 0) {
+        return (size_t)(loop - loops);
+    }
+    size_t pos = loop->open + shift;
+    size_t low = 0;
+    size_t high = loop_count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (loops[middle].open <= pos) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// FNV-1a
+unsigned long long source_hash(const char* code, size_t length) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)code[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Loop profiles are text files: a header with the hash and length of the program, then
+// one line per loop that ran, keyed by the position of its '[': entries, iterations
+// and the trip count histogram
+bool save_loop_profile(const char* path, const char* code, const LoopInfo* loops, size_t loop_count,
+    const LoopProfile* counts) {
+    FILE* file = NULL;
+    errno_t err = fopen_s(&file, path, "w");
+    if (err != 0 || !file) {
+        fprintf(stderr, "Error: Could not open file %s\n", path);
+        return false;
+    }
+    size_t length = strlen(code);
+    fprintf(file, "bf-profile 1 %016llx %zu\n", source_hash(code, length), length);
+    for (size_t i = 0; i < loop_count; i++) {
+        if (counts[i].entries == 0) {
+            continue;
+        }
+        fprintf(file, "%zu %llu %llu", loops[i].open, counts[i].entries, counts[i].iterations);
+        for (int bucket = 0; bucket < TRIP_BUCKETS; bucket++) {
+            fprintf(file, " %llu", counts[i].trips[bucket]);
+        }
+        fputc('\n', file);
+    }
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Error: Could not write file %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Attach the counts saved by an earlier run to the loops. Returns the storage the
+// loops point into, or NULL (after a message) if the profile cannot be used.
+LoopProfile* load_loop_profile(const char* path, const char* code, LoopInfo* loops, size_t loop_count) {
+    FILE* file = NULL;
+    errno_t err = fopen_s(&file, path, "r");
+    if (err != 0 || !file) {
+        fprintf(stderr, "Error: Could not open file %s\n", path);
+        return NULL;
+    }
+    size_t length = strlen(code);
+    int version = 0;
+    unsigned long long hash = 0;
+    size_t profiled_length = 0;
+    if (fscanf(file, "bf-profile %d %llx %zu", &version, &hash, &profiled_length) != 3 || version != 1) {
+        fprintf(stderr, "Error: %s is not a loop profile\n", path);
+        fclose(file);
+        return NULL;
+    }
+    if (hash != source_hash(code, length) || profiled_length != length) {
+        fprintf(stderr, "Warning: Profile %s was saved for a different program and is ignored\n", path);
+        fclose(file);
+        return NULL;
+    }
+    LoopProfile* counts = (LoopProfile*)calloc(loop_count + 1, sizeof(LoopProfile));
+    if (!counts) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        fclose(file);
+        return NULL;
+    }
+
+    size_t open;
+    LoopProfile entry = { 0 };
+    while (fscanf(file, "%zu %llu %llu", &open, &entry.entries, &entry.iterations) == 3) {
+        int bucket = 0;
+        while (bucket < TRIP_BUCKETS && fscanf(file, "%llu", &entry.trips[bucket]) == 1) {
+            bucket++;
+        }
+        if (bucket < TRIP_BUCKETS) {
+            break;
+        }
+        // Loops are sorted by position
+        size_t low = 0;
+        size_t high = loop_count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (loops[middle].open < open) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        if (low < loop_count && loops[low].open == open) {
+            counts[low] = entry;
+            loops[low].profile = &counts[low];
+        }
+    }
+    if (!feof(file)) {
+        fprintf(stderr, "Warning: Profile %s is damaged; only its first loops are used\n", path);
+    }
+    fclose(file);
+    return counts;
+}
+
+// Function to execute brainfuck code with configuration
+void execute_brainfuck(char* code, BrainfuckConfig config) {
+    size_t code_length = strlen(code);
+
+    // Build the bracket structure up front; everything else is compiled lazily
+    LoopInfo* loops = NULL;
+    size_t loop_count = 0;
+    if (!scan_loops(code, code_length, &loops, &loop_count)) {
+        return;
+    }
+
+    if (config.debug_mode || config.breakpoint_count > 0) {
+        free(loops);
+        execute_debug(code, config);
+        return;
+    }
+    bool fitted = fit_tape(code, &config);
+    LoopProfile* profiled = config.profile_in ? load_loop_profile(config.profile_in, code, loops, loop_count) : NULL;
+    Rewrite* rewrites = config.rewrites ? load_rewrites(config.rewrites, code, loops, loop_count) : NULL;
+
+    // Allocate memory for the tape
+    unsigned char* memory = (unsigned char*)calloc(config.memory_size, sizeof(unsigned char));
+    Frame* frames = (Frame*)malloc((MAX_NESTED_LOOPS + 1) * sizeof(Frame));
+    Profile* profile = config.profile ? (Profile*)calloc(1, sizeof(Profile)) : NULL;
+    MemoTable memo = { 0 };
+    if (config.memo) {
+        memo.entries = (MemoEntry*)calloc(MEMO_TABLE_SIZE, sizeof(MemoEntry));
+    }
+    LoopProfile* counts = config.profile_out ? (LoopProfile*)calloc(loop_count + 1, sizeof(LoopProfile)) : NULL;
+    Bytecode bytecode = { 0 };
+    if (!memory || !frames || (config.profile && !profile) || (config.memo && !memo.entries) ||
+        (config.profile_out && !counts)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        free(memory);
+        free(frames);
+        free(profile);
+        free(memo.entries);
+        free(counts);
+        free(profiled);
+        free(rewrites);
+        free(loops);
+        return;
+    }
+    if (fitted) {
+        // Fault in the pages of the fitted tape now rather than during the run
+        for (size_t i = 0; i < config.memory_size; i += PAGE_SIZE) {
+            ((volatile unsigned char*)memory)[i] = 0;
+        }
+    }
+    if (profile) {
+        profile->previous[0] = -1;
+        profile->previous[1] = -1;
+    }
+    if (counts) {
+        // Traces would hide the inner loops they flatten from the loop counts
+        for (size_t i = 0; i < loop_count; i++) {
+            loops[i].untraceable = true;
+        }
+    }
+
+    Block* program = compile_block(code, 0, code_length, loops, 0, &bytecode.constants, config.wrap_memory);
+    size_t program_entry = program ? encode_block(&bytecode, program, OP_HALT) : SIZE_MAX;
+    free_block(program);
+    if (program && program_entry == SIZE_MAX) {
+        fprintf(stderr, "Error: Memory allocation failed while compiling\n");
+    }
+
+    unsigned char* ptr = memory; // Data pointer
+    size_t memory_size = config.memory_size;
+    InputBuffer input = { .pos = 0, .size = 0 };
+
+    // Current instruction and the start of its block; enclosing blocks are kept on the frame stack
+    const uint32_t* pc = bytecode.words + program_entry;
+    size_t start = program_entry;
+    LoopInfo* loop_now = NULL;
+    size_t depth = 0;
+
+    // Source position of the running code minus that of the block it runs, which differ
+    // inside loops that reuse the body of an identical earlier loop
+    size_t shift = 0;
+
+    // Trace being recorded, and the frame depth of the traced loop body
+    Trace* recording = NULL;
+    LoopInfo* recorded_loop = NULL;
+    size_t record_depth = 0;
+
+    while (program_entry != SIZE_MAX) {
+        uint32_t word = *pc;
+
+        if (profile) {
+            profile_count(profile, (int)(word & 0xFF & ~OP_WIDE));
+        }
+
+        if (recording) {
+            // Record each part of a superinstruction on its own
+            const uint32_t* at = pc;
+            bool fused = (word & 0xFF) >= OP_ADD_MOVE && (word & 0xFF) < OP_COUNT;
+            for (int part = 0; part < (fused ? 2 : 1); part++) {
+                Instruction instruction;
+                size_t here = (size_t)(at - bytecode.words);
+                at += decode_instruction(at, &instruction);
+                bool recorded = true;
+                if (instruction.op == OP_LOOP || instruction.op == OP_IF) {
+                    // Record which way the loop test went
+                    recorded = trace_guard(recording, *ptr == 0 ? OP_GUARD_ZERO : OP_GUARD_NONZERO,
+                        frames, record_depth, depth, here, start, loop_now, shift);
+                }
+                else if (instruction.op == OP_BOUNDS) {
+                    // Bounds checks exit the trace; the block's own check then handles the edge case
+                    recorded = trace_guard(recording, OP_GUARD_BOUNDS, frames, record_depth, depth, here, start, loop_now, shift);
+                    if (recorded) {
+                        Instruction* guard = &recording->block.code[recording->block.length - 1];
+                        guard->arg2 = guard->arg;
+                        guard->arg = instruction.arg;
+                        guard->offset = instruction.offset;
+                    }
+                }
+                else if (instruction.op != OP_END) {
+                    recorded = emit_instruction(&recording->block, &recording->code_capacity, instruction);
+                }
+                if (!recorded) {
+                    fprintf(stderr, "Error: Memory allocation failed while recording a trace\n");
+                    goto done;
+                }
+            }
+            if (recording->block.length > MAX_TRACE_LENGTH) {
+                // Too long to pay off (usually an inner loop with many iterations)
+                free_trace(recording);
+                recording = NULL;
+                recorded_loop->untraceable = true;
+            }
+        }
+
+        size_t exit_index;
+        switch (word & 0xFF) {
+        case OP_ADD:
+            ptr[(int32_t)word >> 16] += (unsigned char)(word >> 8);
+            pc++;
+            break;
+
+        case OP_ADD | OP_WIDE:
+            ptr[(int32_t)pc[1]] += (unsigned char)(word >> 8);
+            pc += 2;
+            break;
+
+        case OP_ADD_VECTOR:
+            add_cells(ptr + ((int32_t)word >> 16), bytecode.constants.data + pc[1], (word >> 8) & 0xFF);
+            pc += 2;
+            break;
+
+        case OP_ADD_VECTOR | OP_WIDE:
+            add_cells(ptr + (int32_t)pc[1], bytecode.constants.data + pc[2], (word >> 8) & 0xFF);
+            pc += 3;
+            break;
+
+        case OP_MUL:
+            ptr[(int32_t)word >> 16] += (unsigned char)(ptr[(int32_t)pc[1]] * (word >> 8));
+            pc += 2;
+            break;
+
+        case OP_MUL | OP_WIDE:
+            ptr[(int32_t)pc[1]] += (unsigned char)(ptr[(int32_t)pc[2]] * (word >> 8));
+            pc += 3;
+            break;
+
+        case OP_ADD_ADD:
+            ptr[(int32_t)word >> 16] += (unsigned char)(word >> 8);
+            ptr[(int32_t)pc[1] >> 16] += (unsigned char)(pc[1] >> 8);
+            pc += 2;
+            break;
+
+        case OP_ADD_MOVE:
+            ptr[(int32_t)word >> 16] += (unsigned char)(word >> 8);
+            ptr += (int32_t)pc[1] >> 8;
+            pc += 2;
+            break;
+
+        case OP_MUL_CLEAR:
+            ptr[(int32_t)word >> 16] += (unsigned char)(ptr[(int32_t)pc[1]] * (word >> 8));
+            ptr[(int32_t)pc[2] >> 16] = 0;
+            pc += 3;
+            break;
+
+        case OP_CLEAR:
+            ptr[(int32_t)word >> 16] = 0;
+            pc++;
+            break;
+
+        case OP_CLEAR | OP_WIDE:
+            ptr[(int32_t)pc[1]] = 0;
+            pc += 2;
+            break;
+
+        case OP_SET:
+            ptr[(int32_t)word >> 16] = (unsigned char)(word >> 8);
+            pc++;
+            break;
+
+        case OP_SET | OP_WIDE:
+            ptr[(int32_t)pc[1]] = (unsigned char)(word >> 8);
+            pc += 2;
+            break;
+
+        case OP_MOVE:
+            // Covered by the segment's bounds check
+            ptr += (int32_t)word >> 8;
+            pc++;
+            break;
+
+        case OP_MOVE | OP_WIDE:
+            ptr += (int32_t)pc[1];
+            pc += 2;
+            break;
+
+        case OP_BOUNDS:
+        case OP_BOUNDS | OP_WIDE:
+        case OP_BOUNDS_MOVE: {
+            bool wide = (word & OP_WIDE) != 0;
+            long long low = wide ? (int32_t)pc[1] : (int8_t)(word >> 8);
+            long long high = wide ? (int32_t)pc[2] : (long long)(word >> 16);
+            long long index = (long long)(ptr - memory);
+            if (index + low >= 0 && index + high < (long long)memory_size) {
+                if ((word & 0xFF) == OP_BOUNDS_MOVE) {
+                    ptr += (int32_t)pc[2] >> 8;
+                    pc += 3;
+                }
+                else {
+                    pc += wide ? 4 : 2;
+                }
+                break;
+            }
+            // Too close to a tape edge: run the segment from source, which reports the
+            // exact failing position or wraps around, then continue after it
+            if (recording) {
+                free_trace(recording);
+                recording = NULL;
+                recorded_loop->untraceable = true;
+            }
+            const SegmentInfo* segment = &bytecode.segments[pc[wide ? 3 : 1]];
+            if (!execute_range(code, segment->pos + shift, segment->pos + shift + segment->length, memory, &ptr, &config, &input)) {
+                goto done;
+            }
+            pc += segment->skip;
+            break;
+        }
+
+        case OP_OUTPUT:
+            putchar(ptr[(int32_t)word >> 16]);
+            fflush(stdout);
+            pc++;
+            break;
+
+        case OP_OUTPUT | OP_WIDE:
+            putchar(ptr[(int32_t)pc[1]]);
+            fflush(stdout);
+            pc += 2;
+            break;
+
+        case OP_INPUT:
+            read_input(&input, ptr + ((int32_t)word >> 16), config.eof_behavior);
+            pc++;
+            break;
+
+        case OP_INPUT | OP_WIDE:
+            read_input(&input, ptr + (int32_t)pc[1], config.eof_behavior);
+            pc += 2;
+            break;
+
+        case OP_IF:
+            pc += (*ptr == 0) ? pc[1] : 2;
+            break;
+
+        case OP_LOOP: {
+            if (*ptr == 0) {
+                pc += 2;
+                break;
+            }
+            // Compile the loop body the first time the loop is entered
+            size_t index = pc[1];
+            size_t here = (size_t)(pc - bytecode.words);
+            LoopInfo* loop = &loops[index];
+            if (loop->entry == SIZE_MAX) {
+                if (!compile_loop(code, loops, index, &bytecode, config.wrap_memory)) {
+                    goto done;
+                }
+                loop->memo = memo.entries && memo_window(code, loop, &loop->memo_low, &loop->memo_high);
+                strided_loop(code, loop, &loop->strided);
+            }
+            if (loop->strided.stride != 0 && !recording) {
+                // Strided loop: run its iterations in this one dispatch
+                unsigned long long trips = run_strided_loop(&loop->strided, memory, memory_size, &ptr);
+                if (counts) {
+                    LoopProfile* counted = &counts[profiled_loop(loops, loop_count, loop, shift)];
+                    counted->entries++;
+                    counted->started = counted->iterations;
+                    counted->iterations += trips;
+                    profile_trip(counted);
+                }
+                if (*ptr != 0 && !execute_range(code, loop->open + shift, loop->close + 1 + shift, memory, &ptr, &config, &input)) {
+                    goto done;
+                }
+                pc += 2;
+                break;
+            }
+            long long cell = (long long)(ptr - memory);
+            if (loop->memo && !recording && cell + loop->memo_low >= 0 &&
+                cell + loop->memo_high < (long long)memory_size) {
+                // Look the window up; on a miss run the loop and record its result when it exits
+                unsigned char* window = ptr + loop->memo_low;
+                size_t width = (size_t)(loop->memo_high - loop->memo_low + 1);
+                size_t slot = memo_slot(index, window, width);
+                MemoEntry* entry = &memo.entries[slot];
+                memo.lookups++;
+                loop->memo_lookups++;
+                if (entry->loop == index + 1 && memcmp(entry->input, window, width) == 0) {
+                    memo.hits++;
+                    loop->memo_hits++;
+                    memcpy(window, entry->output, width);
+                    pc += 2;
+                    break;
+                }
+                if (loop->memo_lookups >= MEMO_PROBATION && loop->memo_hits < loop->memo_lookups / 4) {
+                    // Mostly misses: recording results costs more than the hits save
+                    loop->memo = false;
+                    memo.loops_disabled++;
+                }
+                else if (!memo.pending) {
+                    memo.pending = loop;
+                    memo.pending_depth = depth;
+                    memo.pending_slot = slot;
+                    memcpy(memo.pending_input, window, width);
+                }
+            }
+            if (counts) {
+                LoopProfile* counted = &counts[profiled_loop(loops, loop_count, loop, shift)];
+                counted->entries++;
+                counted->started = counted->iterations++;
+            }
+            frames[depth].pc = here;
+            frames[depth].start = start;
+            frames[depth].loop = loop_now;
+            frames[depth].shift = shift;
+            depth++;
+            start = (loop->trace && !recording) ? loop->trace->entry : loop->entry;
+            pc = bytecode.words + start;
+            loop_now = loop;
+            shift += loop->open - loops[loop->shared].open;
+            break;
+        }
+
+        case OP_END:
+            // End of a loop body: test the loop cell again
+            if (recording) {
+                if (depth == record_depth) {
+                    // One full iteration recorded: from now on the loop runs its trace
+                    recording->entry = encode_block(&bytecode, &recording->block, OP_TRACE_END);
+                    if (recording->entry == SIZE_MAX) {
+                        fprintf(stderr, "Error: Memory allocation failed while recording a trace\n");
+                        goto done;
+                    }
+                    free(recording->block.code);
+                    recording->block.code = NULL;
+                    recorded_loop->trace = recording;
+                    recording = NULL;
+                    if (*ptr != 0) {
+                        start = recorded_loop->trace->entry;
+                        pc = bytecode.words + start;
+                        break;
+                    }
+                }
+                else if (!trace_guard(recording, *ptr == 0 ? OP_GUARD_ZERO : OP_GUARD_NONZERO,
+                    frames, record_depth, depth, (size_t)(pc - bytecode.words), start, loop_now, shift)) {
+                    fprintf(stderr, "Error: Memory allocation failed while recording a trace\n");
+                    goto done;
+                }
+            }
+
+            if (*ptr != 0) {
+                loop_now->iterations++;
+                if (counts) {
+                    counts[profiled_loop(loops, loop_count, loop_now, frames[depth - 1].shift)].iterations++;
+                }
+                if (loop_now->trace && !recording) {
+                    start = loop_now->trace->entry;
+                }
+                else if ((loop_now->iterations >= TRACE_HOT_ITERATIONS || profile_hot(loop_now)) && !recording &&
+                    !loop_now->untraceable && !loop_now->trace) {
+                    // Hot loop: record its next iteration
+                    if (!loop_now->has_inner_loops) {
+                        // Nothing to flatten: keep the body with the other hot code instead
+                        loop_now->untraceable = true;
+                        if (!move_loop_to_hot(code, loops, loop_now, &bytecode, config.wrap_memory)) {
+                            goto done;
+                        }
+                        start = loop_now->entry;
+                    }
+                    else if (!(recording = (Trace*)calloc(1, sizeof(Trace)))) {
+                        loop_now->untraceable = true;
+                    }
+                    else {
+                        recording->shift = shift;
+                    }
+                    recorded_loop = loop_now;
+                    record_depth = depth;
+                }
+                pc = bytecode.words + start;
+                break;
+            }
+            if (memo.pending == loop_now && memo.pending_depth == depth - 1) {
+                memo_store(&memo, loops, ptr);
+            }
+            if (counts) {
+                profile_trip(&counts[profiled_loop(loops, loop_count, loop_now, frames[depth - 1].shift)]);
+            }
+            depth--;
+            pc = bytecode.words + frames[depth].pc + 2;
+            start = frames[depth].start;
+            loop_now = frames[depth].loop;
+            shift = frames[depth].shift;
+            break;
+
+        case OP_TRACE_END:
+            if (*ptr != 0) {
+                loop_now->trace_runs++;
+                pc = bytecode.words + start;
+                break;
+            }
+            if (memo.pending == loop_now && memo.pending_depth == depth - 1) {
+                memo_store(&memo, loops, ptr);
+            }
+            depth--;
+            pc = bytecode.words + frames[depth].pc + 2;
+            start = frames[depth].start;
+            loop_now = frames[depth].loop;
+            shift = frames[depth].shift;
+            break;
+
+        case OP_HALT:
+            goto done;
+
+        case OP_GUARD_ZERO:
+        case OP_GUARD_NONZERO:
+            if ((*ptr == 0) == ((word & 0xFF) == OP_GUARD_ZERO)) {
+                pc++;
+                break;
+            }
+            exit_index = word >> 8;
+            goto trace_exit;
+
+        case OP_GUARD_BOUNDS:
+        case OP_GUARD_BOUNDS_MOVE: {
+            long long index = (long long)(ptr - memory);
+            if (index + (int32_t)pc[1] >= 0 && index + (int32_t)pc[2] < (long long)memory_size) {
+                if ((word & 0xFF) == OP_GUARD_BOUNDS_MOVE) {
+                    ptr += (int32_t)pc[3] >> 8;
+                    pc += 4;
+                }
+                else {
+                    pc += 3;
+                }
+                break;
+            }
+            exit_index = word >> 8;
+            goto trace_exit;
+        }
+        }
+        continue;
+
+    trace_exit:
+        {
+            // The recorded path no longer holds: rebuild the interpreter frames and resume there
+            Trace* trace = loop_now->trace;
+            const TraceExit* exit = &trace->exits[exit_index];
+            const Frame* resume = &trace->frames[exit->first_frame];
+            size_t traced_shift = shift;
+            for (size_t i = 0; i + 1 < exit->frame_count; i++) {
+                frames[depth] = resume[i];
+                frames[depth++].shift += traced_shift - trace->shift;
+            }
+            pc = bytecode.words + resume[exit->frame_count - 1].pc;
+            start = resume[exit->frame_count - 1].start;
+            shift = resume[exit->frame_count - 1].shift + traced_shift - trace->shift;
+            LoopInfo* traced = loop_now;
+            loop_now = resume[exit->frame_count - 1].loop;
+
+            // Drop traces whose guards fail on a large share of their runs
+            traced->trace_exits++;
+            if (traced->trace_exits >= TRACE_EXIT_LIMIT && traced->trace_exits > traced->trace_runs / 4) {
+                free_trace(traced->trace);
+                traced->trace = NULL;
+                traced->untraceable = true;
+            }
+        }
+    }
+
+done:
+    if (profile) {
+        print_profile(profile);
+        free(profile);
+    }
+    if (memo.entries) {
+        fprintf(stderr, "Memo: %llu lookups, %llu hits (%.1f%%), %u loops switched off\n",
+            memo.lookups, memo.hits, memo.lookups ? 100.0 * memo.hits / memo.lookups : 0.0,
+            memo.loops_disabled);
+        free(memo.entries);
+    }
+    if (counts) {
+        save_loop_profile(config.profile_out, code, loops, loop_count, counts);
+        free(counts);
+    }
+    free(profiled);
+    free(rewrites);
+
+    // Free the allocated memory
+    for (size_t i = 0; i < loop_count; i++) {
+        free_trace(loops[i].trace);
+    }
+    free_trace(recording);
+    free(bytecode.words);
+    free(bytecode.segments);
+    free(bytecode.constants.data);
+    free(loops);
+    free(frames);
+    free(memory);
+}
+
+// Standalone executables: the compiled program is translated to x86-64 machine code
+// and written out as a static Linux ELF binary with a small syscall-based runtime.
+
+// Fixed layout of the executable
+#define EXE_TEXT_ADDRESS 0x400000
+#define EXE_HEADERS_SIZE (64 + 3 * 56)  // ELF header and three program headers
+#define EXE_OUTPUT_SIZE 4096            // Output is buffered and written in chunks
+#define EXE_READ_SIZE 65536             // Raw input is read in chunks, then split into lines
+
+// Offsets of the runtime data in the zero-initialized data segment
+#define EXE_OUT_BUFFER 0
+#define EXE_OUT_LENGTH (EXE_OUT_BUFFER + EXE_OUTPUT_SIZE)
+#define EXE_READ_POS (EXE_OUT_LENGTH + 8)
+#define EXE_READ_LENGTH (EXE_READ_POS + 8)
+#define EXE_LINE_POS (EXE_READ_LENGTH + 8)
+#define EXE_LINE_LENGTH (EXE_LINE_POS + 8)
+#define EXE_EOF_SEEN (EXE_LINE_LENGTH + 8)
+#define EXE_SAVED_RSP (EXE_EOF_SEEN + 8)  // JIT code only: stack pointer to return to the caller with
+#define EXE_SCRATCH (EXE_SAVED_RSP + 8)
+#define EXE_SCRATCH_SIZE 128
+#define EXE_LINE_BUFFER (EXE_SCRATCH + EXE_SCRATCH_SIZE)
+#define EXE_READ_BUFFER (EXE_LINE_BUFFER + INPUT_BUFFER_SIZE)
+#define EXE_TAPE (((EXE_READ_BUFFER + EXE_READ_SIZE) + 0xFFF) & ~0xFFF)
+
+// JIT code only: data after the tape for outermost loops compiled the first time they
+// run (see jit_compile_loop). It holds the addresses of the runtime routines, a clock
+// that loops stamp on entry, then for each loop its code address and last stamp.
+#define JIT_LOOP_DATA(memory_size) ((EXE_TAPE + (unsigned long long)(memory_size) + 0xFFF) & ~0xFFFULL)
+#define JIT_RUNTIME_COUNT 5
+#define JIT_CLOCK (JIT_RUNTIME_COUNT * 8)
+#define JIT_LOOP_SLOTS (JIT_CLOCK + 8)
+#define JIT_LOOP_SLOT_SIZE 16
+
+// A jump, call or address to patch once the target label is placed
+typedef struct {
+    size_t at;
+    size_t label;
+    bool absolute;  // 32-bit absolute address instead of a relative displacement
+} Fixup;
+
+// Machine code buffer with labels
+typedef struct {
+    unsigned char* code;
+    size_t length;
+    size_t capacity;
+    size_t* labels;
+    size_t label_count;
+    size_t label_capacity;
+    Fixup* fixups;
+    size_t fixup_count;
+    size_t fixup_capacity;
+    bool ok;
+} Assembler;
+
+// Segment whose edge-of-tape version is emitted out of line, after the program
+typedef struct {
+    size_t label;
+    size_t resume;
+    size_t start;
+    size_t end;
+} SlowPath;
+
+// Vector constant placed after the code and read with RIP-relative addressing
+typedef struct {
+    size_t label;
+    size_t size;
+    unsigned char bytes[64];
+} NativeLiteral;
+
+// Place in debuggable JIT code where execution can move to the interpreter, see native_emit_site
+typedef struct {
+    size_t label;
+    size_t pos;  // Source position the interpreter continues from
+} NativeSite;
+
+typedef struct {
+    Assembler as;
+    const char* code;
+    LoopInfo* loops;
+    ConstantPool* constants;
+    BrainfuckConfig config;
+    unsigned long long data_address;  // Address of the zero-initialized data segment
+    bool jit;               // Run in this process by --jit: return to the caller instead of exiting
+    int vector_width;       // Widest vector registers the code may use: 16 (SSE2), 32 (AVX2) or 64 (AVX-512BW)
+    NativeLiteral* literals;
+    size_t literal_count;
+    size_t literal_capacity;
+    bool debuggable;        // JIT code with breakpoints: loops get sites, and input is not read ahead
+    NativeSite* sites;
+    size_t site_count;
+    size_t site_capacity;
+    SlowPath* slow_paths;
+    size_t slow_count;
+    size_t slow_capacity;
+    size_t shift;           // Source shift of the loop copy being emitted, see LoopInfo.shared
+    unsigned long long loop_data;  // JIT loop data when outermost loops are compiled on first entry, else 0
+    bool lazy;              // Loops are emitted as calls through their slot in the loop data
+    unsigned long long compile_loop;  // Address of the function rt_compile calls
+    const size_t* copies;   // Number of loops sharing each loop's source text
+    size_t* shared_labels;  // Label of each loop emitted as a subroutine, SIZE_MAX if none
+    size_t* shared_queue;   // Loops whose subroutine has yet to be emitted
+    size_t shared_count;
+    size_t rt_output;  // Runtime routines
+    size_t rt_input;
+    size_t rt_flush;
+    size_t rt_exit;
+    size_t rt_bounds_error;
+    size_t rt_compile;  // Only with loop_data: compiles the loop in eax and runs it
+} NativeCompiler;
+
+void asm_bytes(Assembler* as, const unsigned char* bytes, size_t count) {
+    if (!as->ok) {
+        return;
+    }
+    if (as->length + count > as->capacity) {
+        size_t new_capacity = as->capacity ? as->capacity * 2 : 4096;
+        while (new_capacity < as->length + count) {
+            new_capacity *= 2;
+        }
+        unsigned char* grown = (unsigned char*)realloc(as->code, new_capacity);
+        if (!grown) {
+            as->ok = false;
+            return;
+        }
+        as->code = grown;
+        as->capacity = new_capacity;
+    }
+    memcpy(as->code + as->length, bytes, count);
+    as->length += count;
+}
+
+void asm_byte(Assembler* as, unsigned char byte) {
+    asm_bytes(as, &byte, 1);
+}
+
+void asm_u32(Assembler* as, unsigned int value) {
+    unsigned char bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+    asm_bytes(as, bytes, 4);
+}
+
+void asm_u64(Assembler* as, unsigned long long value) {
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+    asm_bytes(as, bytes, 8);
+}
+
+size_t asm_new_label(Assembler* as) {
+    if (as->label_count == as->label_capacity) {
+        size_t new_capacity = as->label_capacity ? as->label_capacity * 2 : 256;
+        size_t* grown = (size_t*)realloc(as->labels, new_capacity * sizeof(size_t));
+        if (!grown) {
+            as->ok = false;
+            return 0;
+        }
+        as->labels = grown;
+        as->label_capacity = new_capacity;
+    }
+    as->labels[as->label_count] = SIZE_MAX;
+    return as->label_count++;
+}
+
+void asm_bind(Assembler* as, size_t label) {
+    if (as->ok) {
+        as->labels[label] = as->length;
+    }
+}
+
+// Emit a 32-bit field referring to a label
+void asm_label_ref(Assembler* as, size_t label, bool absolute) {
+    if (!as->ok) {
+        return;
+    }
+    if (as->fixup_count == as->fixup_capacity) {
+        size_t new_capacity = as->fixup_capacity ? as->fixup_capacity * 2 : 256;
+        Fixup* grown = (Fixup*)realloc(as->fixups, new_capacity * sizeof(Fixup));
+        if (!grown) {
+            as->ok = false;
+            return;
+        }
+        as->fixups = grown;
+        as->fixup_capacity = new_capacity;
+    }
+    as->fixups[as->fixup_count].at = as->length;
+    as->fixups[as->fixup_count].label = label;
+    as->fixups[as->fixup_count].absolute = absolute;
+    as->fixup_count++;
+    asm_u32(as, 0);
+}
+
+// jmp/call (one opcode byte) or jcc (0x0F, opcode) to a label
+void asm_jump(Assembler* as, unsigned char opcode, size_t label) {
+    asm_byte(as, opcode);
+    asm_label_ref(as, label, false);
+}
+
+void asm_jcc(Assembler* as, unsigned char condition, size_t label) {
+    asm_byte(as, 0x0F);
+    asm_byte(as, condition);
+    asm_label_ref(as, label, false);
+}
+
+#define X86_JMP 0xE9
+#define X86_CALL 0xE8
+#define X86_JB 0x82
+#define X86_JAE 0x83
+#define X86_JE 0x84
+#define X86_JNE 0x85
+#define X86_JBE 0x86
+#define X86_JA 0x87
+#define X86_JS 0x88
+#define X86_JLE 0x8E
+#define X86_JG 0x8F
+
+// Opcode bytes, a ModRM/SIB pair selecting an absolute address, then the address
+void asm_absolute(Assembler* as, const unsigned char* prefix, size_t count, unsigned long long address) {
+    asm_bytes(as, prefix, count);
+    asm_u32(as, (unsigned int)address);
+}
+
+// Opcode bytes ending in a ModRM byte with a disp32 field, then the displacement
+void asm_disp32(Assembler* as, const unsigned char* prefix, size_t count, int displacement) {
+    asm_bytes(as, prefix, count);
+    asm_u32(as, (unsigned int)displacement);
+}
+
+// Opcode bytes ending in a ModRM byte selecting RIP-relative addressing, then the
+// displacement to a label. Nothing may follow the displacement.
+void asm_rip(Assembler* as, const unsigned char* prefix, size_t count, size_t label) {
+    asm_bytes(as, prefix, count);
+    asm_label_ref(as, label, false);
+}
+
+// mov rcx/rdi, imm64
+void asm_mov_rcx(Assembler* as, unsigned long long value) {
+    asm_byte(as, 0x48);
+    asm_byte(as, 0xB9);
+    asm_u64(as, value);
+}
+
+void asm_mov_rdi(Assembler* as, unsigned long long value) {
+    asm_byte(as, 0x48);
+    asm_byte(as, 0xBF);
+    asm_u64(as, value);
+}
+
+// Resolve all label references for code loaded at base
+void asm_finish(Assembler* as, unsigned long long base) {
+    for (size_t i = 0; as->ok && i < as->fixup_count; i++) {
+        const Fixup* fixup = &as->fixups[i];
+        unsigned long long target = as->labels[fixup->label];
+        unsigned int value = fixup->absolute
+            ? (unsigned int)(base + target)
+            : (unsigned int)(target - (fixup->at + 4));
+        for (int b = 0; b < 4; b++) {
+            as->code[fixup->at + b] = (unsigned char)(value >> (8 * b));
+        }
+    }
+}
+
+void asm_free(Assembler* as) {
+    free(as->code);
+    free(as->labels);
+    free(as->fixups);
+}
+
+// Emit the runtime routines. Generated code keeps the data pointer in rbx, the tape
+// start in r12 and the tape end in r13; routines may clobber every other register.
+void native_emit_runtime(NativeCompiler* nc) {
+    Assembler* as = &nc->as;
+    unsigned long long data = nc->data_address;
+
+    nc->rt_output = asm_new_label(as);
+    nc->rt_input = asm_new_label(as);
+    nc->rt_flush = asm_new_label(as);
+    nc->rt_exit = asm_new_label(as);
+    nc->rt_bounds_error = asm_new_label(as);
+    size_t read_byte = asm_new_label(as);
+    size_t fill_line = asm_new_label(as);
+    size_t message = asm_new_label(as);
+
+    // rt_flush: write out the output buffer
+    {
+        size_t loop = asm_new_label(as);
+        size_t done = asm_new_label(as);
+        asm_bind(as, nc->rt_flush);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x8B, 0x14, 0x25 }, 4, data + EXE_OUT_LENGTH); // mov rdx, [out_length]
+        asm_bytes(as, (const unsigned char[]) { 0xBE }, 1);                                            // mov esi, out_buffer
+        asm_u32(as, (unsigned int)(data + EXE_OUT_BUFFER));
+        asm_bind(as, loop);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x85, 0xD2 }, 3);                               // test rdx, rdx
+        asm_jcc(as, X86_JE, done);
+        asm_bytes(as, (const unsigned char[]) { 0xB8, 1, 0, 0, 0, 0xBF, 1, 0, 0, 0, 0x0F, 0x05 }, 12); // write(1, rsi, rdx)
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x85, 0xC0 }, 3);                               // test rax, rax
+        asm_bytes(as, (const unsigned char[]) { 0x0F, 0x8E }, 2);                                     // jle done
+        asm_label_ref(as, done, false);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x01, 0xC6, 0x48, 0x29, 0xC2 }, 6);             // add rsi, rax; sub rdx, rax
+        asm_jump(as, X86_JMP, loop);
+        asm_bind(as, done);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0xC7, 0x04, 0x25 }, 4, data + EXE_OUT_LENGTH); // mov qword [out_length], 0
+        asm_u32(as, 0);
+        asm_byte(as, 0xC3);                                                                            // ret
+    }
+
+    // rt_output: append al to the output buffer
+    {
+        size_t done = asm_new_label(as);
+        asm_bind(as, nc->rt_output);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x8B, 0x0C, 0x25 }, 4, data + EXE_OUT_LENGTH); // mov rcx, [out_length]
+        asm_absolute(as, (const unsigned char[]) { 0x88, 0x81 }, 2, data + EXE_OUT_BUFFER);            // mov [rcx + out_buffer], al
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0xFF, 0xC1 }, 3);                               // inc rcx
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x89, 0x0C, 0x25 }, 4, data + EXE_OUT_LENGTH); // mov [out_length], rcx
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x81, 0xF9 }, 3);                               // cmp rcx, EXE_OUTPUT_SIZE
+        asm_u32(as, EXE_OUTPUT_SIZE);
+        asm_jcc(as, X86_JE, nc->rt_flush);
+        asm_bind(as, done);
+        asm_byte(as, 0xC3);                                                                            // ret
+    }
+
+    // read_byte: next raw input byte in eax, or -1 at end of input (which is sticky, like stdio)
+    {
+        size_t have = asm_new_label(as);
+        size_t eof = asm_new_label(as);
+        size_t got = asm_new_label(as);
+        asm_bind(as, read_byte);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x8B, 0x0C, 0x25 }, 4, data + EXE_READ_POS);   // mov rcx, [read_pos]
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x3B, 0x0C, 0x25 }, 4, data + EXE_READ_LENGTH); // cmp rcx, [read_length]
+        asm_jcc(as, X86_JB, have);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x8B, 0x0C, 0x25 }, 4, data + EXE_EOF_SEEN);   // mov rcx, [eof_seen]
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x85, 0xC9 }, 3);                               // test rcx, rcx
+        asm_jcc(as, X86_JNE, eof);
+        asm_jump(as, X86_CALL, nc->rt_flush);                                                          // show pending output before blocking
+        asm_bytes(as, (const unsigned char[]) { 0x31, 0xC0, 0x31, 0xFF }, 4);                         // xor eax, eax; xor edi, edi
+        asm_bytes(as, (const unsigned char[]) { 0xBE }, 1);                                            // mov esi, read_buffer
+        asm_u32(as, (unsigned int)(data + EXE_READ_BUFFER));
+        // Debuggable code reads a byte at a time, leaving the rest to the interpreter it may stop in
+        asm_bytes(as, (const unsigned char[]) { 0xBA }, 1);                                            // mov edx, EXE_READ_SIZE
+        asm_u32(as, nc->debuggable ? 1 : EXE_READ_SIZE);
+        asm_bytes(as, (const unsigned char[]) { 0x0F, 0x05 }, 2);                                     // read(0, rsi, rdx)
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0xC7, 0x04, 0x25 }, 4, data + EXE_READ_POS);   // mov qword [read_pos], 0
+        asm_u32(as, 0);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x85, 0xC0 }, 3);                               // test rax, rax
+        asm_jcc(as, X86_JG, got);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0xC7, 0x04, 0x25 }, 4, data + EXE_EOF_SEEN);   // mov qword [eof_seen], 1
+        asm_u32(as, 1);
+        asm_bytes(as, (const unsigned char[]) { 0x31, 0xC0 }, 2);                                     // xor eax, eax
+        asm_bind(as, got);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x89, 0x04, 0x25 }, 4, data + EXE_READ_LENGTH); // mov [read_length], rax
+        asm_jump(as, X86_JMP, read_byte);
+        asm_bind(as, eof);
+        asm_bytes(as, (const unsigned char[]) { 0xB8, 0xFF, 0xFF, 0xFF, 0xFF, 0xC3 }, 6);             // mov eax, -1; ret
+        asm_bind(as, have);
+        asm_absolute(as, (const unsigned char[]) { 0x0F, 0xB6, 0x81 }, 3, data + EXE_READ_BUFFER);     // movzx eax, byte [rcx + read_buffer]
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0xFF, 0xC1 }, 3);                               // inc rcx
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x89, 0x0C, 0x25 }, 4, data + EXE_READ_POS);   // mov [read_pos], rcx
+        asm_byte(as, 0xC3);                                                                            // ret
+    }
+
+    // fill_line: read one line like fgets, prompting on a terminal, and keep it up to its first NUL
+    {
+        size_t no_prompt = asm_new_label(as);
+        size_t loop = asm_new_label(as);
+        size_t end = asm_new_label(as);
+        size_t scan = asm_new_label(as);
+        size_t done = asm_new_label(as);
+        asm_bind(as, fill_line);
+        asm_bytes(as, (const unsigned char[]) { 0xB8, 16, 0, 0, 0, 0x31, 0xFF }, 7);                   // ioctl(0, TCGETS, scratch)
+        asm_bytes(as, (const unsigned char[]) { 0xBE, 0x01, 0x54, 0, 0 }, 5);
+        asm_bytes(as, (const unsigned char[]) { 0xBA }, 1);
+        asm_u32(as, (unsigned int)(data + EXE_SCRATCH));
+        asm_bytes(as, (const unsigned char[]) { 0x0F, 0x05 }, 2);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x85, 0xC0 }, 3);                               // test rax, rax
+        asm_jcc(as, X86_JNE, no_prompt);
+        const char* prompt = "\nInput: ";
+        for (const char* c = prompt; *c; c++) {
+            asm_bytes(as, (const unsigned char[]) { 0xB0, (unsigned char)*c }, 2);                    // mov al, c
+            asm_jump(as, X86_CALL, nc->rt_output);
+        }
+        asm_jump(as, X86_CALL, nc->rt_flush);
+        asm_bind(as, no_prompt);
+        asm_bytes(as, (const unsigned char[]) { 0x45, 0x31, 0xC0 }, 3);                               // xor r8d, r8d
+        asm_bind(as, loop);
+        asm_bytes(as, (const unsigned char[]) { 0x49, 0x81, 0xF8 }, 3);                               // cmp r8, INPUT_BUFFER_SIZE - 1
+        asm_u32(as, INPUT_BUFFER_SIZE - 1);
+        asm_jcc(as, X86_JAE, end);
+        asm_jump(as, X86_CALL, read_byte);
+        asm_bytes(as, (const unsigned char[]) { 0x85, 0xC0 }, 2);                                     // test eax, eax
+        asm_jcc(as, X86_JS, end);
+        asm_absolute(as, (const unsigned char[]) { 0x41, 0x88, 0x80 }, 3, data + EXE_LINE_BUFFER);     // mov [r8 + line_buffer], al
+        asm_bytes(as, (const unsigned char[]) { 0x49, 0xFF, 0xC0 }, 3);                               // inc r8
+        asm_bytes(as, (const unsigned char[]) { 0x3C, 0x0A }, 2);                                     // cmp al, '\n'
+        asm_jcc(as, X86_JNE, loop);
+        asm_bind(as, end);
+        asm_bytes(as, (const unsigned char[]) { 0x31, 0xC9 }, 2);                                     // xor ecx, ecx
+        asm_bind(as, scan);
+        asm_bytes(as, (const unsigned char[]) { 0x4C, 0x39, 0xC1 }, 3);                               // cmp rcx, r8
+        asm_jcc(as, X86_JAE, done);
+        asm_absolute(as, (const unsigned char[]) { 0x80, 0xB9 }, 2, data + EXE_LINE_BUFFER);           // cmp byte [rcx + line_buffer], 0
+        asm_byte(as, 0);
+        asm_jcc(as, X86_JE, done);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0xFF, 0xC1 }, 3);                               // inc rcx
+        asm_jump(as, X86_JMP, scan);
+        asm_bind(as, done);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x89, 0x0C, 0x25 }, 4, data + EXE_LINE_LENGTH); // mov [line_length], rcx
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0xC7, 0x04, 0x25 }, 4, data + EXE_LINE_POS);   // mov qword [line_pos], 0
+        asm_u32(as, 0);
+        asm_byte(as, 0xC3);                                                                            // ret
+    }
+
+    // rt_input: read one byte into the cell at rdi, following read_input
+    {
+        size_t have = asm_new_label(as);
+        size_t retry = asm_new_label(as);
+        asm_bind(as, nc->rt_input);
+        asm_bytes(as, (const unsigned char[]) { 0x49, 0x89, 0xF9 }, 3);                               // mov r9, rdi
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x8B, 0x0C, 0x25 }, 4, data + EXE_LINE_POS);   // mov rcx, [line_pos]
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x3B, 0x0C, 0x25 }, 4, data + EXE_LINE_LENGTH); // cmp rcx, [line_length]
+        asm_jcc(as, X86_JB, have);
+        asm_jump(as, X86_CALL, fill_line);
+        asm_bind(as, retry);
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x8B, 0x0C, 0x25 }, 4, data + EXE_LINE_POS);   // mov rcx, [line_pos]
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x3B, 0x0C, 0x25 }, 4, data + EXE_LINE_LENGTH); // cmp rcx, [line_length]
+        asm_jcc(as, X86_JB, have);
+        if (nc->config.eof_behavior) {
+            asm_bytes(as, (const unsigned char[]) { 0x41, 0xC6, 0x01, 0x00 }, 4);                     // mov byte [r9], 0
+        }
+        asm_byte(as, 0xC3);                                                                            // ret
+        asm_bind(as, have);
+        asm_absolute(as, (const unsigned char[]) { 0x8A, 0x81 }, 2, data + EXE_LINE_BUFFER);           // mov al, [rcx + line_buffer]
+        asm_bytes(as, (const unsigned char[]) { 0x41, 0x88, 0x01 }, 3);                               // mov [r9], al
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0xFF, 0xC1 }, 3);                               // inc rcx
+        asm_absolute(as, (const unsigned char[]) { 0x48, 0x89, 0x0C, 0x25 }, 4, data + EXE_LINE_POS);   // mov [line_pos], rcx
+        asm_byte(as, 0xC3);                                                                            // ret
+    }
+
+    // rt_bounds_error: report the out of bounds position in rdi, then exit
+    {
+        const char* text = "Error: Data pointer out of bounds at position ";
+        size_t text_length = strlen(text);
+        size_t digits = asm_new_label(as);
+        unsigned long long end = data + EXE_SCRATCH + EXE_SCRATCH_SIZE;
+        asm_bind(as, nc->rt_bounds_error);
+        asm_bytes(as, (const unsigned char[]) { 0x4C, 0x01, 0xF7 }, 3);                               // add rdi, r14
+        asm_bytes(as, (const unsigned char[]) { 0x57 }, 1);                                            // push rdi
+        asm_jump(as, X86_CALL, nc->rt_flush);
+        asm_bytes(as, (const unsigned char[]) { 0xB8, 1, 0, 0, 0, 0xBF, 2, 0, 0, 0 }, 10);             // write(2, message, length)
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x8D, 0x35 }, 3);                               // lea rsi, [rip + message]
+        asm_label_ref(as, message, false);
+        asm_bytes(as, (const unsigned char[]) { 0xBA }, 1);
+        asm_u32(as, (unsigned int)text_length);
+        asm_bytes(as, (const unsigned char[]) { 0x0F, 0x05 }, 2);
+        asm_bytes(as, (const unsigned char[]) { 0x58 }, 1);                                            // pop rax
+        asm_bytes(as, (const unsigned char[]) { 0xBE }, 1);                                            // mov esi, end - 1
+        asm_u32(as, (unsigned int)(end - 1));
+        asm_bytes(as, (const unsigned char[]) { 0xC6, 0x06, 0x0A }, 3);                               // mov byte [rsi], '\n'
+        asm_bytes(as, (const unsigned char[]) { 0xB9, 10, 0, 0, 0 }, 5);                              // mov ecx, 10
+        asm_bind(as, digits);
+        asm_bytes(as, (const unsigned char[]) { 0x31, 0xD2, 0x48, 0xF7, 0xF1 }, 5);                   // xor edx, edx; div rcx
+        asm_bytes(as, (const unsigned char[]) { 0x80, 0xC2, '0', 0x48, 0xFF, 0xCE, 0x88, 0x16 }, 8);  // add dl, '0'; dec rsi; mov [rsi], dl
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x85, 0xC0 }, 3);                               // test rax, rax
+        asm_jcc(as, X86_JNE, digits);
+        asm_bytes(as, (const unsigned char[]) { 0xBA }, 1);                                            // mov edx, end
+        asm_u32(as, (unsigned int)end);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x29, 0xF2 }, 3);                               // sub rdx, rsi
+        asm_bytes(as, (const unsigned char[]) { 0xB8, 1, 0, 0, 0, 0xBF, 2, 0, 0, 0, 0x0F, 0x05 }, 12); // write(2, rsi, rdx)
+        // Fall through to rt_exit: the interpreter also finishes normally after an error
+
+        asm_bind(as, nc->rt_exit);
+        asm_jump(as, X86_CALL, nc->rt_flush);
+        if (nc->jit) {
+            asm_absolute(as, (const unsigned char[]) { 0x48, 0x8B, 0x24, 0x25 }, 4, data + EXE_SAVED_RSP); // mov rsp, [saved_rsp]
+            asm_bytes(as, (const unsigned char[]) { 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3 }, 11); // pop r15-r12, rbp, rbx; ret
+        }
+        else {
+            asm_bytes(as, (const unsigned char[]) { 0xB8, 231, 0, 0, 0, 0x31, 0xFF, 0x0F, 0x05 }, 9);  // exit_group(0)
+        }
+
+        asm_bind(as, message);
+        asm_bytes(as, (const unsigned char*)text, text_length);
+    }
+}
+
+// Move rbx by count cells with the interpreter's checks: wrap around, or report the
+// position of the first '<' or '>' (starting at pos) that would leave the tape
+void native_emit_checked_move(NativeCompiler* nc, long long count, size_t pos) {
+    Assembler* as = &nc->as;
+    unsigned long long size = nc->config.memory_size;
+    unsigned long long step = (unsigned long long)(count > 0 ? count : -count);
+
+    if (nc->config.wrap_memory) {
+        step %= size;
+        if (step == 0) {
+            return;
+        }
+        size_t ok = asm_new_label(as);
+        asm_mov_rcx(as, step);
+        if (count > 0) {
+            asm_bytes(as, (const unsigned char[]) { 0x48, 0x01, 0xCB }, 3);       // add rbx, rcx
+            asm_bytes(as, (const unsigned char[]) { 0x4C, 0x39, 0xEB }, 3);       // cmp rbx, r13
+            asm_jcc(as, X86_JB, ok);
+            asm_mov_rcx(as, size);
+            asm_bytes(as, (const unsigned char[]) { 0x48, 0x29, 0xCB }, 3);       // sub rbx, rcx
+        }
+        else {
+            asm_bytes(as, (const unsigned char[]) { 0x48, 0x29, 0xCB }, 3);       // sub rbx, rcx
+            asm_bytes(as, (const unsigned char[]) { 0x4C, 0x39, 0xE3 }, 3);       // cmp rbx, r12
+            asm_jcc(as, X86_JAE, ok);
+            asm_mov_rcx(as, size);
+            asm_bytes(as, (const unsigned char[]) { 0x48, 0x01, 0xCB }, 3);       // add rbx, rcx
+        }
+        asm_bind(as, ok);
+        return;
+    }
+
+    size_t ok = asm_new_label(as);
+    asm_bytes(as, (const unsigned char[]) { 0x48, 0x89, 0xD8, 0x4C, 0x29, 0xE0 }, 6); // mov rax, rbx; sub rax, r12
+    if (count > 0) {
+        if (step <= size - 1) {
+            asm_mov_rcx(as, size - 1 - step);
+            asm_bytes(as, (const unsigned char[]) { 0x48, 0x39, 0xC8 }, 3);       // cmp rax, rcx
+            asm_jcc(as, X86_JBE, ok);
+        }
+        asm_mov_rdi(as, pos + size - 1);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x29, 0xC7 }, 3);           // sub rdi, rax
+        asm_jump(as, X86_JMP, nc->rt_bounds_error);
+        asm_bind(as, ok);
+        asm_mov_rcx(as, step);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x01, 0xCB }, 3);           // add rbx, rcx
+    }
+    else {
+        asm_mov_rcx(as, step);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x39, 0xC8 }, 3);           // cmp rax, rcx
+        asm_jcc(as, X86_JAE, ok);
+        asm_mov_rdi(as, pos);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x01, 0xC7 }, 3);           // add rdi, rax
+        asm_jump(as, X86_JMP, nc->rt_bounds_error);
+        asm_bind(as, ok);
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x29, 0xCB }, 3);           // sub rbx, rcx
+    }
+}
+
+// Translate the source range [start, end) character by character, with the same
+// checks as execute_range. Used for segments that come near a tape edge.
+void native_emit_source(NativeCompiler* nc, size_t start, size_t end) {
+    Assembler* as = &nc->as;
+    const char* code = nc->code;
+    size_t loop_labels[2 * MAX_NESTED_LOOPS];
+    size_t depth = 0;
+
+    for (size_t pos = start; pos < end; pos++) {
+        switch (code[pos]) {
+        case '+':
+        case '-': {
+            int delta = 0;
+            while (pos < end && (code[pos] == '+' || code[pos] == '-')) {
+                delta += (code[pos] == '+') ? 1 : -1;
+                pos++;
+            }
+            pos--;
+            asm_bytes(as, (const unsigned char[]) { 0x80, 0x03, (unsigned char)delta }, 3); // add byte [rbx], delta
+            break;
+        }
+
+        case '>':
+        case '<': {
+            size_t run_start = pos;
+            char direction = code[pos];
+            long long count = 0;
+            while (pos < end && code[pos] == direction) {
+                count++;
+                pos++;
+            }
+            pos--;
+            native_emit_checked_move(nc, direction == '>' ? count : -count, run_start);
+            break;
+        }
+
+        case '.':
+            asm_bytes(as, (const unsigned char[]) { 0x0F, 0xB6, 0x03 }, 3);       // movzx eax, byte [rbx]
+            asm_jump(as, X86_CALL, nc->rt_output);
+            break;
+
+        case ',':
+            asm_bytes(as, (const unsigned char[]) { 0x48, 0x89, 0xDF }, 3);       // mov rdi, rbx
+            asm_jump(as, X86_CALL, nc->rt_input);
+            break;
+
+        case '[':
+            loop_labels[2 * depth] = asm_new_label(as);
+            loop_labels[2 * depth + 1] = asm_new_label(as);
+            asm_bytes(as, (const unsigned char[]) { 0x80, 0x3B, 0x00 }, 3);       // cmp byte [rbx], 0
+            asm_jcc(as, X86_JE, loop_labels[2 * depth + 1]);
+            asm_bind(as, loop_labels[2 * depth]);
+            depth++;
+            break;
+
+        case ']':
+            depth--;
+            asm_bytes(as, (const unsigned char[]) { 0x80, 0x3B, 0x00 }, 3);       // cmp byte [rbx], 0
+            asm_jcc(as, X86_JNE, loop_labels[2 * depth]);
+            asm_bind(as, loop_labels[2 * depth + 1]);
+            break;
+        }
+    }
+}
+
+// Place a vector constant after the code; returns the label to address it by
+size_t native_literal(NativeCompiler* nc, const unsigned char* bytes, size_t size) {
+    if (nc->literal_count == nc->literal_capacity) {
+        size_t new_capacity = nc->literal_capacity ? nc->literal_capacity * 2 : 64;
+        NativeLiteral* grown = (NativeLiteral*)realloc(nc->literals, new_capacity * sizeof(NativeLiteral));
+        if (!grown) {
+            nc->as.ok = false;
+            return 0;
+        }
+        nc->literals = grown;
+        nc->literal_capacity = new_capacity;
+    }
+    NativeLiteral* literal = &nc->literals[nc->literal_count++];
+    literal->label = asm_new_label(&nc->as);
+    literal->size = size;
+    memcpy(literal->bytes, bytes, size);
+    return literal->label;
+}
+
+// Number of instructions from ip on, before limit, that multiply by the same source
+// cell as the one at ip, as the instructions of a multiply loop do
+size_t native_mul_run(const Block* block, size_t ip, size_t limit) {
+    const Instruction* first = &block->code[ip];
+    size_t end = ip;
+    while (end < limit && end - ip < MAX_PENDING_ADDS && block->code[end].op == OP_MUL &&
+        block->code[end].arg2 == first->arg2 && block->code[end].pos == first->pos &&
+        block->code[end].offset != first->arg2) {
+        end++;
+    }
+    return end - ip;
+}
+
+// Emit a run of multiplications by one source cell. Targets close together are done
+// with one vector multiply and add: cells are bytes, so the source is broadcast as 16-bit
+// words and multiplied by the factors of the even and of the odd cells separately. The
+// source stays in eax and its broadcast in xmm3, ymm3 or zmm3; vzeroupper follows wide
+// registers before any SSE instruction. Every cell between the source and the targets is
+// on the tape, as the segment's bounds check covers them.
+void native_emit_mul_run(NativeCompiler* nc, const Instruction* run, size_t count) {
+    Assembler* as = &nc->as;
+    int source = run[0].arg2;
+    int offsets[MAX_PENDING_ADDS];
+    unsigned char factors[MAX_PENDING_ADDS];
+    int targets = 0;
+    for (size_t i = 0; i < count; i++) {
+        int j = 0;
+        while (j < targets && offsets[j] < run[i].offset) {
+            j++;
+        }
+        if (j < targets && offsets[j] == run[i].offset) {
+            factors[j] = (unsigned char)(factors[j] + run[i].arg);
+            continue;
+        }
+        memmove(offsets + j + 1, offsets + j, (size_t)(targets - j) * sizeof(int));
+        memmove(factors + j + 1, factors + j, (size_t)(targets - j));
+        offsets[j] = run[i].offset;
+        factors[j] = (unsigned char)run[i].arg;
+        targets++;
+    }
+    int low = offsets[0] < source ? offsets[0] : source;
+    int high = offsets[targets - 1] > source ? offsets[targets - 1] : source;
+
+    asm_disp32(as, (const unsigned char[]) { 0x0F, 0xB6, 0x83 }, 3, source);          // movzx eax, byte [rbx + source]
+    int broadcast = 0;
+    bool upper = false;
+    int written = low;  // Vectors do not overlap, as a load from a store just made to part of it stalls
+    int i = 0;
+    while (i < targets) {
+        // The narrowest vector covering the most targets from this one on, shifted back
+        // where it would pass the last cell known to be on the tape
+        int width = 0;
+        int start = 0;
+        int covered = 0;
+        for (int w = nc->vector_width; w >= 8; w /= 2) {
+            int s = (offsets[i] + w - 1 > high) ? high - w + 1 : offsets[i];
+            int c = 0;
+            while (s >= written && i + c < targets && offsets[i + c] < s + w) {
+                c++;
+            }
+            if (c >= MIN_VECTOR_ADD && c >= covered) {
+                width = w;
+                start = s;
+                covered = c;
+            }
+        }
+        if (width == 0) {
+            if (factors[i] != 0) {
+                asm_bytes(as, (const unsigned char[]) { 0x69, 0xC8 }, 2);                  // imul ecx, eax, factor
+                asm_u32(as, factors[i]);
+                asm_disp32(as, (const unsigned char[]) { 0x00, 0x8B }, 2, offsets[i]);    // add [rbx + offset], cl
+            }
+            i++;
+            continue;
+        }
+
+        unsigned char even[64];
+        unsigned char odd[64];
+        memset(even, 0, sizeof(even));
+        memset(odd, 0, sizeof(odd));
+        for (int j = i; j < i + covered; j++) {
+            int k = offsets[j] - start;
+            if (k % 2 == 0) {
+                even[k] = factors[j];
+            }
+            else {
+                odd[k] = factors[j];
+            }
+        }
+        size_t even_label = native_literal(nc, even, (size_t)width);
+        size_t odd_label = native_literal(nc, odd, (size_t)width);
+        i += covered;
+        written = start + width;
+
+        if (width <= 16 && upper) {
+            asm_bytes(as, (const unsigned char[]) { 0xC5, 0xF8, 0x77 }, 3);                // vzeroupper
+            upper = false;
+            broadcast = broadcast > 16 ? 16 : broadcast;
+        }
+        if (broadcast == 0) {
+            asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0x6E, 0xD8 }, 4);          // movd xmm3, eax
+            asm_bytes(as, (const unsigned char[]) { 0xF2, 0x0F, 0x70, 0xDB, 0x00 }, 5);    // pshuflw xmm3, xmm3, 0
+            asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0x6C, 0xDB }, 4);          // punpcklqdq xmm3, xmm3
+            broadcast = 16;
+        }
+
+        if (width <= 16) {
+            if (width == 16) {
+                asm_rip(as, (const unsigned char[]) { 0xF3, 0x0F, 0x6F, 0x05 }, 4, even_label);  // movdqu xmm0, [even]
+                asm_rip(as, (const unsigned char[]) { 0xF3, 0x0F, 0x6F, 0x0D }, 4, odd_label);   // movdqu xmm1, [odd]
+            }
+            else {
+                asm_rip(as, (const unsigned char[]) { 0xF3, 0x0F, 0x7E, 0x05 }, 4, even_label);  // movq xmm0, [even]
+                asm_rip(as, (const unsigned char[]) { 0xF3, 0x0F, 0x7E, 0x0D }, 4, odd_label);   // movq xmm1, [odd]
+            }
+            asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xD5, 0xC3 }, 4);          // pmullw xmm0, xmm3
+            asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xD5, 0xCB }, 4);          // pmullw xmm1, xmm3
+            asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0x71, 0xF0, 0x08 }, 5);    // psllw xmm0, 8
+            asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0x71, 0xD0, 0x08 }, 5);    // psrlw xmm0, 8
+            asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xEB, 0xC1 }, 4);          // por xmm0, xmm1
+            if (width == 16) {
+                asm_disp32(as, (const unsigned char[]) { 0xF3, 0x0F, 0x6F, 0x93 }, 4, start);   // movdqu xmm2, [rbx + start]
+                asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xFC, 0xC2 }, 4);           // paddb xmm0, xmm2
+                asm_disp32(as, (const unsigned char[]) { 0xF3, 0x0F, 0x7F, 0x83 }, 4, start);   // movdqu [rbx + start], xmm0
+            }
+            else {
+                asm_disp32(as, (const unsigned char[]) { 0xF3, 0x0F, 0x7E, 0x93 }, 4, start);   // movq xmm2, [rbx + start]
+                asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xFC, 0xC2 }, 4);           // paddb xmm0, xmm2
+                asm_disp32(as, (const unsigned char[]) { 0x66, 0x0F, 0xD6, 0x83 }, 4, start);   // movq [rbx + start], xmm0
+            }
+        }
+        else if (width == 32) {
+            if (broadcast < 32) {
+                asm_bytes(as, (const unsigned char[]) { 0xC4, 0xE2, 0x7D, 0x79, 0xDB }, 5);     // vpbroadcastw ymm3, xmm3
+                broadcast = 32;
+            }
+            asm_rip(as, (const unsigned char[]) { 0xC5, 0xE5, 0xD5, 0x05 }, 4, even_label);     // vpmullw ymm0, ymm3, [even]
+            asm_rip(as, (const unsigned char[]) { 0xC5, 0xE5, 0xD5, 0x0D }, 4, odd_label);      // vpmullw ymm1, ymm3, [odd]
+            asm_bytes(as, (const unsigned char[]) { 0xC5, 0xFD, 0x71, 0xF0, 0x08 }, 5);         // vpsllw ymm0, ymm0, 8
+            asm_bytes(as, (const unsigned char[]) { 0xC5, 0xFD, 0x71, 0xD0, 0x08 }, 5);         // vpsrlw ymm0, ymm0, 8
+            asm_bytes(as, (const unsigned char[]) { 0xC5, 0xFD, 0xEB, 0xC1 }, 4);               // vpor ymm0, ymm0, ymm1
+            asm_disp32(as, (const unsigned char[]) { 0xC5, 0xFD, 0xFC, 0x83 }, 4, start);       // vpaddb ymm0, ymm0, [rbx + start]
+            asm_disp32(as, (const unsigned char[]) { 0xC5, 0xFE, 0x7F, 0x83 }, 4, start);       // vmovdqu [rbx + start], ymm0
+            upper = true;
+        }
+        else {
+            if (broadcast < 64) {
+                asm_bytes(as, (const unsigned char[]) { 0x62, 0xF2, 0x7D, 0x48, 0x79, 0xDB }, 6);   // vpbroadcastw zmm3, xmm3
+                broadcast = 64;
+            }
+            asm_rip(as, (const unsigned char[]) { 0x62, 0xF1, 0x65, 0x48, 0xD5, 0x05 }, 6, even_label); // vpmullw zmm0, zmm3, [even]
+            asm_rip(as, (const unsigned char[]) { 0x62, 0xF1, 0x65, 0x48, 0xD5, 0x0D }, 6, odd_label);  // vpmullw zmm1, zmm3, [odd]
+            asm_bytes(as, (const unsigned char[]) { 0x62, 0xF1, 0x7D, 0x48, 0x71, 0xF0, 0x08 }, 7);     // vpsllw zmm0, zmm0, 8
+            asm_bytes(as, (const unsigned char[]) { 0x62, 0xF1, 0x7D, 0x48, 0x71, 0xD0, 0x08 }, 7);     // vpsrlw zmm0, zmm0, 8
+            asm_bytes(as, (const unsigned char[]) { 0x62, 0xF1, 0xFD, 0x48, 0xEB, 0xC1 }, 6);           // vporq zmm0, zmm0, zmm1
+            asm_disp32(as, (const unsigned char[]) { 0x62, 0xF1, 0x7D, 0x48, 0xFC, 0x83 }, 6, start);   // vpaddb zmm0, zmm0, [rbx + start]
+            asm_disp32(as, (const unsigned char[]) { 0x62, 0xF1, 0x7F, 0x48, 0x7F, 0x83 }, 6, start);   // vmovdqu8 [rbx + start], zmm0
+            upper = true;
+        }
+    }
+    if (upper) {
+        asm_bytes(as, (const unsigned char[]) { 0xC5, 0xF8, 0x77 }, 3);                    // vzeroupper
+    }
+}
+
+// In debuggable code, a one-byte nop where the tape and pointer are exactly as after
+// running the source up to pos, with nothing held in registers. A breakpoint puts an
+// int3 over it, and the program then continues in the interpreter from pos.
+void native_emit_site(NativeCompiler* nc, size_t pos) {
+    if (!nc->debuggable) {
+        return;
+    }
+    if (nc->site_count == nc->site_capacity) {
+        size_t new_capacity = nc->site_capacity ? nc->site_capacity * 2 : 64;
+        NativeSite* grown = (NativeSite*)realloc(nc->sites, new_capacity * sizeof(NativeSite));
+        if (!grown) {
+            nc->as.ok = false;
+            return;
+        }
+        nc->sites = grown;
+        nc->site_capacity = new_capacity;
+    }
+    NativeSite* site = &nc->sites[nc->site_count++];
+    site->label = asm_new_label(&nc->as);
+    site->pos = pos;
+    asm_bind(&nc->as, site->label);
+    asm_byte(&nc->as, 0x90);                                                      // nop
+}
+
+bool native_emit_block(NativeCompiler* nc, Block* block);
+
+// Scan loops such as [>] and [<]: look for the zero cell 16 cells at a time while
+// a whole block of cells is on the tape, and leave the cells near its ends to the loop body
+void native_emit_zero_scan(NativeCompiler* nc, int stride, size_t head, size_t body, size_t end) {
+    Assembler* as = &nc->as;
+    size_t found = asm_new_label(as);
+    if (stride > 0) {
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x8D, 0x43, 0x10 }, 4);    // lea rax, [rbx + 16]
+        asm_bytes(as, (const unsigned char[]) { 0x4C, 0x39, 0xE8 }, 3);          // cmp rax, r13
+        asm_jcc(as, X86_JAE, body);
+        asm_bytes(as, (const unsigned char[]) { 0xF3, 0x0F, 0x6F, 0x03 }, 4);    // movdqu xmm0, [rbx]
+    }
+    else {
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x8D, 0x43, 0xF1 }, 4);    // lea rax, [rbx - 15]
+        asm_bytes(as, (const unsigned char[]) { 0x4C, 0x39, 0xE0 }, 3);          // cmp rax, r12
+        asm_jcc(as, X86_JBE, body);
+        asm_bytes(as, (const unsigned char[]) { 0xF3, 0x0F, 0x6F, 0x00 }, 4);    // movdqu xmm0, [rax]
+    }
+    asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xEF, 0xC9 }, 4);        // pxor xmm1, xmm1
+    asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0x74, 0xC1 }, 4);        // pcmpeqb xmm0, xmm1
+    asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xD7, 0xC8 }, 4);        // pmovmskb ecx, xmm0
+    asm_bytes(as, (const unsigned char[]) { 0x85, 0xC9 }, 2);                    // test ecx, ecx
+    asm_jcc(as, X86_JNE, found);
+    if (stride > 0) {
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x83, 0xC3, 0x10 }, 4);    // add rbx, 16
+    }
+    else {
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x83, 0xEB, 0x10 }, 4);    // sub rbx, 16
+    }
+    asm_jump(as, X86_JMP, head);
+    asm_bind(as, found);
+    if (stride > 0) {
+        asm_bytes(as, (const unsigned char[]) { 0x0F, 0xBC, 0xC9 }, 3);          // bsf ecx, ecx
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x01, 0xCB }, 3);          // add rbx, rcx
+    }
+    else {
+        asm_bytes(as, (const unsigned char[]) { 0x0F, 0xBD, 0xC9 }, 3);          // bsr ecx, ecx
+        asm_bytes(as, (const unsigned char[]) { 0x48, 0x8D, 0x1C, 0x08 }, 4);    // lea rbx, [rax + rcx]
+    }
+    asm_jump(as, X86_JMP, end);
+}
+
+// Emit the body of loop index with its loop test. Identical loops share one compiled
+// body; large ones are also emitted only once, as a subroutine called from every copy.
+// r14 then holds the source shift of the calling copy, for error positions.
+bool native_emit_loop(NativeCompiler* nc, size_t index) {
+    Assembler* as = &nc->as;
+    size_t shared_index = nc->loops[index].shared;
+    LoopInfo* loop = &nc->loops[shared_index];
+    size_t shift = nc->shift + (nc->loops[index].open - loop->open);
+    if (nc->lazy) {
+        // Compiled the first time it runs, through rt_compile, which the slot points at until then
+        if (shift != 0) {
+            asm_mov_rcx(as, shift);
+            asm_bytes(as, (const unsigned char[]) { 0x49, 0x01, 0xCE }, 3);       // add r14, rcx
+        }
+        asm_byte(as, 0xB8);                                                       // mov eax, index
+        asm_u32(as, (unsigned int)shared_index);
+        asm_absolute(as, (const unsigned char[]) { 0xFF, 0x14, 0x25 }, 3,
+            nc->loop_data + JIT_LOOP_SLOTS + JIT_LOOP_SLOT_SIZE * shared_index);   // call [slot]
+        if (shift != 0) {
+            asm_mov_rcx(as, shift);
+            asm_bytes(as, (const unsigned char[]) { 0x49, 0x29, 0xCE }, 3);       // sub r14, rcx
+        }
+        return as->ok;
+    }
+    if (!loop->body) {
+        loop->body = compile_block(nc->code, loop->open + 1, loop->close, nc->loops, shared_index + 1, nc->constants,
+            nc->config.wrap_memory);
+        if (!loop->body) {
+            return false;
+        }
+    }
+
+    size_t end = asm_new_label(as);
+    size_t head = asm_new_label(as);
+    size_t body = asm_new_label(as);
+    native_emit_site(nc, loop->open + shift);
+    asm_bind(as, head);
+    asm_bytes(as, (const unsigned char[]) { 0x80, 0x3B, 0x00 }, 3);               // cmp byte [rbx], 0
+    asm_jcc(as, X86_JE, end);
+    StridedLoop strided;
+    if (strided_loop(nc->code, loop, &strided) && strided.target_count == 0 &&
+        (strided.stride == 1 || strided.stride == -1)) {
+        native_emit_zero_scan(nc, strided.stride, head, body, end);
+    }
+    else if (nc->copies[shared_index] > 1 && loop->close - loop->open >= MIN_SHARED_LOOP && !nc->debuggable) {
+        // Sites need one source position each, so debuggable code has no shared loops
+        if (nc->shared_labels[shared_index] == SIZE_MAX) {
+            nc->shared_labels[shared_index] = asm_new_label(as);
+            nc->shared_queue[nc->shared_count++] = shared_index;
+        }
+        if (shift != 0) {
+            asm_mov_rcx(as, shift);
+            asm_bytes(as, (const unsigned char[]) { 0x49, 0x01, 0xCE }, 3);       // add r14, rcx
+        }
+        asm_jump(as, X86_CALL, nc->shared_labels[shared_index]);
+        if (shift != 0) {
+            asm_mov_rcx(as, shift);
+            asm_bytes(as, (const unsigned char[]) { 0x49, 0x29, 0xCE }, 3);       // sub r14, rcx
+        }
+        asm_bind(as, end);
+        return as->ok;
+    }
+
+    size_t saved_shift = nc->shift;
+    nc->shift = shift;
+    if (profile_hot(&nc->loops[index])) {
+        // Start loops that were hot in the profiled run on a 16-byte boundary
+        while (as->length % 16 != 0) {
+            asm_byte(as, 0x90);                                                   // nop
+        }
+    }
+    asm_bind(as, body);
+    if (!native_emit_block(nc, loop->body)) {
+        return false;
+    }
+    nc->shift = saved_shift;
+    asm_bytes(as, (const unsigned char[]) { 0x80, 0x3B, 0x00 }, 3);               // cmp byte [rbx], 0
+    asm_jcc(as, X86_JNE, body);
+    asm_bind(as, end);
+    native_emit_site(nc, loop->close + 1 + shift);
+    return as->ok;
+}
+
+// Emit a loop shared by several copies as a subroutine, entered with its cell non-zero
+bool native_emit_shared_loop(NativeCompiler* nc, size_t index) {
+    Assembler* as = &nc->as;
+    while (as->length % 16 != 0) {
+        asm_byte(as, 0xCC);                                                       // int3 padding
+    }
+    asm_bind(as, nc->shared_labels[index]);
+    size_t body = asm_new_label(as);
+    asm_bind(as, body);
+    nc->shift = 0;
+    if (!native_emit_block(nc, nc->loops[index].body)) {
+        return false;
+    }
+    asm_bytes(as, (const unsigned char[]) { 0x80, 0x3B, 0x00 }, 3);               // cmp byte [rbx], 0
+    asm_jcc(as, X86_JNE, body);
+    asm_byte(as, 0xC3);                                                           // ret
+    return as->ok;
+}
+
+bool native_emit_block(NativeCompiler* nc, Block* block) {
+    Assembler* as = &nc->as;
+    size_t resume = SIZE_MAX;
+    size_t segment_end = 0;
+
+    // Labels and target instructions of the enclosing OP_IF branches
+    size_t* branch_labels = NULL;
+    size_t* branch_targets = NULL;
+    size_t branch_count = 0;
+
+    for (size_t ip = 0; ip < block->length; ip++) {
+        const Instruction* instruction = &block->code[ip];
+
+        while (branch_count > 0 && branch_targets[branch_count - 1] == ip) {
+            asm_bind(as, branch_labels[--branch_count]);
+        }
+        if (resume != SIZE_MAX && instruction->pos >= segment_end) {
+            asm_bind(as, resume);
+            resume = SIZE_MAX;
+        }
+
+        switch (instruction->op) {
+        case OP_ADD:
+            asm_disp32(as, (const unsigned char[]) { 0x80, 0x83 }, 2, instruction->offset); // add byte [rbx + offset], arg
+            asm_byte(as, (unsigned char)instruction->arg);
+            break;
+
+        case OP_ADD_VECTOR: {
+            // AVX-512 and AVX2 byte additions of 64 and 32 cells with the constants placed after
+            // the code, where available, then SSE2 ones of 16 and 8 cells with the constants
+            // loaded as immediates
+            const unsigned char* values = nc->constants->data + instruction->arg2;
+            int count = instruction->arg;
+            int done = 0;
+            for (int width = nc->vector_width; width >= 32; width /= 2) {
+                for (; done + width <= count; done += width) {
+                    size_t label = native_literal(nc, values + done, (size_t)width);
+                    if (width == 64) {
+                        asm_rip(as, (const unsigned char[]) { 0x62, 0xF1, 0x7F, 0x48, 0x6F, 0x05 }, 6, label);            // vmovdqu8 zmm0, [values]
+                        asm_disp32(as, (const unsigned char[]) { 0x62, 0xF1, 0x7D, 0x48, 0xFC, 0x83 }, 6, instruction->offset + done); // vpaddb zmm0, zmm0, [rbx + offset]
+                        asm_disp32(as, (const unsigned char[]) { 0x62, 0xF1, 0x7F, 0x48, 0x7F, 0x83 }, 6, instruction->offset + done); // vmovdqu8 [rbx + offset], zmm0
+                    }
+                    else {
+                        asm_rip(as, (const unsigned char[]) { 0xC5, 0xFE, 0x6F, 0x05 }, 4, label);                        // vmovdqu ymm0, [values]
+                        asm_disp32(as, (const unsigned char[]) { 0xC5, 0xFD, 0xFC, 0x83 }, 4, instruction->offset + done); // vpaddb ymm0, ymm0, [rbx + offset]
+                        asm_disp32(as, (const unsigned char[]) { 0xC5, 0xFE, 0x7F, 0x83 }, 4, instruction->offset + done); // vmovdqu [rbx + offset], ymm0
+                    }
+                }
+            }
+            if (done > 0) {
+                asm_bytes(as, (const unsigned char[]) { 0xC5, 0xF8, 0x77 }, 3);                 // vzeroupper
+            }
+            for (; done + 8 <= count; done += (count - done >= 16) ? 16 : 8) {
+                unsigned long long low = 0;
+                unsigned long long high = 0;
+                for (int b = 0; b < 8; b++) {
+                    low |= (unsigned long long)values[done + b] << (8 * b);
+                }
+                asm_bytes(as, (const unsigned char[]) { 0x48, 0xB8 }, 2);                        // mov rax, low
+                asm_u64(as, low);
+                asm_bytes(as, (const unsigned char[]) { 0x66, 0x48, 0x0F, 0x6E, 0xC8 }, 5);      // movq xmm1, rax
+                if (count - done >= 16) {
+                    for (int b = 0; b < 8; b++) {
+                        high |= (unsigned long long)values[done + 8 + b] << (8 * b);
+                    }
+                    asm_bytes(as, (const unsigned char[]) { 0x48, 0xBA }, 2);                    // mov rdx, high
+                    asm_u64(as, high);
+                    asm_bytes(as, (const unsigned char[]) { 0x66, 0x48, 0x0F, 0x6E, 0xD2 }, 5);  // movq xmm2, rdx
+                    asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0x6C, 0xCA }, 4);        // punpcklqdq xmm1, xmm2
+                    asm_disp32(as, (const unsigned char[]) { 0xF3, 0x0F, 0x6F, 0x83 }, 4, instruction->offset + done); // movdqu xmm0, [rbx + offset]
+                    asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xFC, 0xC1 }, 4);        // paddb xmm0, xmm1
+                    asm_disp32(as, (const unsigned char[]) { 0xF3, 0x0F, 0x7F, 0x83 }, 4, instruction->offset + done); // movdqu [rbx + offset], xmm0
+                }
+                else {
+                    asm_disp32(as, (const unsigned char[]) { 0xF3, 0x0F, 0x7E, 0x83 }, 4, instruction->offset + done); // movq xmm0, [rbx + offset]
+                    asm_bytes(as, (const unsigned char[]) { 0x66, 0x0F, 0xFC, 0xC1 }, 4);        // paddb xmm0, xmm1
+                    asm_disp32(as, (const unsigned char[]) { 0x66, 0x0F, 0xD6, 0x83 }, 4, instruction->offset + done); // movq [rbx + offset], xmm0
+                }
+            }
+            for (; done < count; done++) {
+                if (values[done] != 0) {
+                    asm_disp32(as, (const unsigned char[]) { 0x80, 0x83 }, 2, instruction->offset + done); // add byte [rbx + offset], value
+                    asm_byte(as, values[done]);
+                }
+            }
+            break;
+        }
+
+        case OP_MUL: {
+            // The multiplications of a multiply loop with many targets go together
+            size_t run = native_mul_run(block, ip, branch_count > 0 ? branch_targets[branch_count - 1] : block->length);
+            if (run >= MIN_VECTOR_ADD) {
+                native_emit_mul_run(nc, instruction, run);
+                ip += run - 1;
+                break;
+            }
+            asm_disp32(as, (const unsigned char[]) { 0x0F, 0xB6, 0x83 }, 3, instruction->arg2); // movzx eax, byte [rbx + arg2]
+            asm_bytes(as, (const unsigned char[]) { 0x69, 0xC0 }, 2);                           // imul eax, eax, arg
+            asm_u32(as, (unsigned int)instruction->arg);
+            asm_disp32(as, (const unsigned char[]) { 0x00, 0x83 }, 2, instruction->offset);      // add [rbx + offset], al
+            break;
+        }
+
+        case OP_CLEAR:
+        case OP_SET:
+            asm_disp32(as, (const unsigned char[]) { 0xC6, 0x83 }, 2, instruction->offset);      // mov byte [rbx + offset], arg
+            asm_byte(as, instruction->op == OP_SET ? (unsigned char)instruction->arg : 0);
+            break;
+
+        case OP_MOVE:
+            asm_disp32(as, (const unsigned char[]) { 0x48, 0x81, 0xC3 }, 3, instruction->arg);   // add rbx, arg
+            break;
+
+        case OP_BOUNDS: {
+            // Fast path when the whole segment stays on the tape, else the out of line version
+            SlowPath slow = { .label = asm_new_label(as), .resume = asm_new_label(as),
+                .start = nc->shift + instruction->pos, .end = nc->shift + instruction->pos + (size_t)instruction->arg2 };
+            unsigned long long size = nc->config.memory_size;
+            asm_bytes(as, (const unsigned char[]) { 0x48, 0x89, 0xD8, 0x4C, 0x29, 0xE0 }, 6); // mov rax, rbx; sub rax, r12
+            if (instruction->offset < 0) {
+                asm_mov_rcx(as, (unsigned long long)(-(long long)instruction->offset));
+                asm_bytes(as, (const unsigned char[]) { 0x48, 0x39, 0xC8 }, 3);                   // cmp rax, rcx
+                asm_jcc(as, X86_JB, slow.label);
+            }
+            if (instruction->arg > 0) {
+                if ((unsigned long long)instruction->arg >= size) {
+                    asm_jump(as, X86_JMP, slow.label);
+                }
+                else {
+                    asm_mov_rcx(as, size - (unsigned long long)instruction->arg);
+                    asm_bytes(as, (const unsigned char[]) { 0x48, 0x39, 0xC8 }, 3);               // cmp rax, rcx
+                    asm_jcc(as, X86_JAE, slow.label);
+                }
+            }
+            if (nc->slow_count == nc->slow_capacity) {
+                size_t new_capacity = nc->slow_capacity ? nc->slow_capacity * 2 : 64;
+                SlowPath* grown = (SlowPath*)realloc(nc->slow_paths, new_capacity * sizeof(SlowPath));
+                if (!grown) {
+                    free(branch_labels);
+                    free(branch_targets);
+                    as->ok = false;
+                    return false;
+                }
+                nc->slow_paths = grown;
+                nc->slow_capacity = new_capacity;
+            }
+            nc->slow_paths[nc->slow_count++] = slow;
+            resume = slow.resume;
+            segment_end = instruction->pos + (size_t)instruction->arg2;
+            break;
+        }
+
+        case OP_OUTPUT:
+            asm_disp32(as, (const unsigned char[]) { 0x0F, 0xB6, 0x83 }, 3, instruction->offset); // movzx eax, byte [rbx + offset]
+            asm_jump(as, X86_CALL, nc->rt_output);
+            break;
+
+        case OP_INPUT:
+            asm_disp32(as, (const unsigned char[]) { 0x48, 0x8D, 0xBB }, 3, instruction->offset); // lea rdi, [rbx + offset]
+            asm_jump(as, X86_CALL, nc->rt_input);
+            break;
+
+        case OP_IF:
+            if (!branch_labels) {
+                branch_labels = (size_t*)malloc(block->length * sizeof(size_t));
+                branch_targets = (size_t*)malloc(block->length * sizeof(size_t));
+                if (!branch_labels || !branch_targets) {
+                    free(branch_labels);
+                    free(branch_targets);
+                    as->ok = false;
+                    return false;
+                }
+            }
+            branch_labels[branch_count] = asm_new_label(as);
+            branch_targets[branch_count] = ip + 1 + (size_t)instruction->arg;
+            asm_bytes(as, (const unsigned char[]) { 0x80, 0x3B, 0x00 }, 3);               // cmp byte [rbx], 0
+            asm_jcc(as, X86_JE, branch_labels[branch_count]);
+            branch_count++;
+            break;
+
+        case OP_LOOP:
+            if (!native_emit_loop(nc, (size_t)instruction->arg)) {
+                free(branch_labels);
+                free(branch_targets);
+                return false;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    while (branch_count > 0) {
+        asm_bind(as, branch_labels[--branch_count]);
+    }
+    if (resume != SIZE_MAX) {
+        asm_bind(as, resume);
+    }
+    free(branch_labels);
+    free(branch_targets);
+    return as->ok;
+}
+
+void put_u16(unsigned char* at, unsigned int value) {
+    at[0] = (unsigned char)value;
+    at[1] = (unsigned char)(value >> 8);
+}
+
+void put_u32(unsigned char* at, unsigned int value) {
+    for (int i = 0; i < 4; i++) {
+        at[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+void put_u64(unsigned char* at, unsigned long long value) {
+    for (int i = 0; i < 8; i++) {
+        at[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+// Fill in one ELF64 program header
+void put_program_header(unsigned char* at, unsigned int type, unsigned int flags,
+    unsigned long long address, unsigned long long file_size, unsigned long long memory_size) {
+    put_u32(at, type);
+    put_u32(at + 4, flags);
+    put_u64(at + 8, 0);              // p_offset
+    put_u64(at + 16, address);       // p_vaddr
+    put_u64(at + 24, address);       // p_paddr
+    put_u64(at + 32, file_size);
+    put_u64(at + 40, memory_size);
+    put_u64(at + 48, 0x1000);        // p_align
+}
+
+// Loop table and compiled IR that native code is emitted from
+typedef struct {
+    LoopInfo* loops;
+    size_t loop_count;
+    LoopProfile* profiled;
+    Rewrite* rewrites;
+    ConstantPool constants;
+    Block* program;
+    size_t* copies;         // See NativeCompiler
+    size_t* shared_labels;
+    size_t* shared_queue;
+} NativeSource;
+
+void native_source_free(NativeSource* source) {
+    free(source->copies);
+    free(source->shared_labels);
+    free(source->shared_queue);
+    if (source->loops) {
+        for (size_t i = 0; i < source->loop_count; i++) {
+            free_block(source->loops[i].body);
+        }
+    }
+    free_block(source->program);
+    free(source->constants.data);
+    free(source->profiled);
+    free(source->rewrites);
+    free(source->loops);
+}
+
+bool native_source_init(NativeSource* source, const char* code, const BrainfuckConfig* config) {
+    memset(source, 0, sizeof(*source));
+    size_t code_length = strlen(code);
+    if (!scan_loops(code, code_length, &source->loops, &source->loop_count)) {
+        return false;
+    }
+
+    source->profiled = config->profile_in ? load_loop_profile(config->profile_in, code, source->loops, source->loop_count) : NULL;
+    source->rewrites = config->rewrites ? load_rewrites(config->rewrites, code, source->loops, source->loop_count) : NULL;
+
+    source->program = compile_block(code, 0, code_length, source->loops, 0, &source->constants, config->wrap_memory);
+    if (!source->program) {
+        native_source_free(source);
+        return false;
+    }
+
+    // Loops with the same source text as others are emitted once where that pays off
+    source->copies = (size_t*)calloc(source->loop_count + 1, sizeof(size_t));
+    source->shared_labels = (size_t*)malloc((source->loop_count + 1) * sizeof(size_t));
+    source->shared_queue = (size_t*)malloc((source->loop_count + 1) * sizeof(size_t));
+    if (!source->copies || !source->shared_labels || !source->shared_queue) {
+        fprintf(stderr, "Error: Memory allocation failed while compiling\n");
+        native_source_free(source);
+        return false;
+    }
+    for (size_t i = 0; i < source->loop_count; i++) {
+        source->copies[source->loops[i].shared]++;
+    }
+    return true;
+}
+
+// Widest vector registers of this CPU. Compiled executables may run on another
+// machine, so only JIT code, compiled where it runs, goes past SSE2.
+int native_vector_width(void) {
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        return 64;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return 32;
+    }
+#endif
+    return 16;
+}
+
+void native_compiler_init(NativeCompiler* nc, NativeSource* source, const char* code,
+    BrainfuckConfig config, unsigned long long data_address, bool jit) {
+    memset(nc, 0, sizeof(*nc));
+    nc->as.ok = true;
+    nc->code = code;
+    nc->loops = source->loops;
+    nc->constants = &source->constants;
+    nc->config = config;
+    nc->data_address = data_address;
+    nc->jit = jit;
+    nc->vector_width = jit ? native_vector_width() : 16;
+    nc->debuggable = jit && config.breakpoint_count > 0;
+    nc->copies = source->copies;
+    nc->shared_labels = source->shared_labels;
+    nc->shared_queue = source->shared_queue;
+    for (size_t i = 0; i < source->loop_count; i++) {
+        source->shared_labels[i] = SIZE_MAX;
+    }
+}
+
+// Runtime routines in the order of the table in the JIT loop data
+void native_runtime_labels(NativeCompiler* nc, size_t* labels[JIT_RUNTIME_COUNT]) {
+    labels[0] = &nc->rt_output;
+    labels[1] = &nc->rt_input;
+    labels[2] = &nc->rt_flush;
+    labels[3] = &nc->rt_exit;
+    labels[4] = &nc->rt_bounds_error;
+}
+
+// Shared loops, which run once per copy, follow the code; the edge-of-tape slow paths,
+// which rarely run at all, go last, then the vector constants
+bool native_emit_tail(NativeCompiler* nc) {
+    bool ok = nc->as.ok;
+    for (size_t i = 0; ok && i < nc->shared_count; i++) {
+        ok = native_emit_shared_loop(nc, nc->shared_queue[i]);
+    }
+    for (size_t i = 0; ok && i < nc->slow_count; i++) {
+        asm_bind(&nc->as, nc->slow_paths[i].label);
+        native_emit_source(nc, nc->slow_paths[i].start, nc->slow_paths[i].end);
+        asm_jump(&nc->as, X86_JMP, nc->slow_paths[i].resume);
+    }
+    for (size_t i = 0; ok && i < nc->literal_count; i++) {
+        asm_bind(&nc->as, nc->literals[i].label);
+        asm_bytes(&nc->as, nc->literals[i].bytes, nc->literals[i].size);
+    }
+    return ok && nc->as.ok;
+}
+
+// Emit the whole program for a data segment at data_address. The entry point is label 0.
+// In JIT code the program saves the caller's registers on entry and returns to it at
+// the end, instead of exiting the process. With loop_data, the outermost loops are left
+// out and compiled the first time they run, by calling compile_loop.
+bool native_emit_program(NativeCompiler* nc, NativeSource* source, const char* code,
+    BrainfuckConfig config, unsigned long long data_address, bool jit,
+    unsigned long long loop_data, unsigned long long compile_loop) {
+    native_compiler_init(nc, source, code, config, data_address, jit);
+    nc->loop_data = loop_data;
+    nc->compile_loop = compile_loop;
+
+    size_t entry = asm_new_label(&nc->as);
+    native_emit_runtime(nc);
+    if (loop_data) {
+        // rt_compile: called from a loop's slot with the loop in eax; jit_compile_loop
+        // returns the loop's new code, which returns to the caller
+        nc->rt_compile = asm_new_label(&nc->as);
+        asm_bind(&nc->as, nc->rt_compile);
+        asm_bytes(&nc->as, (const unsigned char[]) { 0x55, 0x48, 0x89, 0xE5, 0x48, 0x83, 0xE4, 0xF0 }, 8); // push rbp; mov rbp, rsp; and rsp, -16
+        asm_bytes(&nc->as, (const unsigned char[]) { 0x89, 0xC7, 0x48, 0xB8 }, 4);  // mov edi, eax; mov rax, compile_loop
+        asm_u64(&nc->as, compile_loop);
+        asm_bytes(&nc->as, (const unsigned char[]) { 0xFF, 0xD0 }, 2);                // call rax
+        asm_bytes(&nc->as, (const unsigned char[]) { 0x48, 0x89, 0xEC, 0x5D }, 4);    // mov rsp, rbp; pop rbp
+        asm_bytes(&nc->as, (const unsigned char[]) { 0xFF, 0xE0 }, 2);                // jmp rax
+    }
+    asm_bind(&nc->as, entry);
+    if (jit) {
+        asm_bytes(&nc->as, (const unsigned char[]) { 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 }, 10); // push rbx, rbp, r12-r15
+        asm_absolute(&nc->as, (const unsigned char[]) { 0x48, 0x89, 0x24, 0x25 }, 4, data_address + EXE_SAVED_RSP); // mov [saved_rsp], rsp
+    }
+    asm_bytes(&nc->as, (const unsigned char[]) { 0x49, 0xBC }, 2);                   // mov r12, tape
+    asm_u64(&nc->as, data_address + EXE_TAPE);
+    asm_bytes(&nc->as, (const unsigned char[]) { 0x4C, 0x89, 0xE3 }, 3);             // mov rbx, r12
+    asm_bytes(&nc->as, (const unsigned char[]) { 0x49, 0xBD }, 2);                   // mov r13, tape end
+    asm_u64(&nc->as, data_address + EXE_TAPE + config.memory_size);
+    asm_bytes(&nc->as, (const unsigned char[]) { 0x45, 0x31, 0xF6 }, 3);             // xor r14d, r14d
+    nc->lazy = loop_data != 0;
+    bool ok = native_emit_block(nc, source->program);
+    nc->lazy = false;
+    asm_jump(&nc->as, X86_JMP, nc->rt_exit);
+    return ok && native_emit_tail(nc);
+}
+
+// Emit the loop index on its own, for --jit to compile the first time it runs: a
+// subroutine entered at the loop's '[' that returns after its ']', with the entry point
+// at the start. It stamps the clock in the loop data on entry, for the code cache to tell
+// how recently it ran, and reaches the runtime routines through the table there.
+bool native_emit_loop_program(NativeCompiler* nc, NativeSource* source, const char* code,
+    BrainfuckConfig config, unsigned long long data_address, unsigned long long loop_data, size_t index) {
+    native_compiler_init(nc, source, code, config, data_address, true);
+    Assembler* as = &nc->as;
+    size_t* routines[JIT_RUNTIME_COUNT];
+    native_runtime_labels(nc, routines);
+    for (int i = 0; i < JIT_RUNTIME_COUNT; i++) {
+        *routines[i] = asm_new_label(as);
+    }
+
+    asm_absolute(as, (const unsigned char[]) { 0x48, 0x8B, 0x04, 0x25 }, 4, loop_data + JIT_CLOCK);  // mov rax, [clock]
+    asm_bytes(as, (const unsigned char[]) { 0x48, 0xFF, 0xC0 }, 3);                                 // inc rax
+    asm_absolute(as, (const unsigned char[]) { 0x48, 0x89, 0x04, 0x25 }, 4, loop_data + JIT_CLOCK);  // mov [clock], rax
+    asm_absolute(as, (const unsigned char[]) { 0x48, 0x89, 0x04, 0x25 }, 4,
+        loop_data + JIT_LOOP_SLOTS + JIT_LOOP_SLOT_SIZE * index + 8);                                // mov [stamp], rax
+    bool ok = native_emit_loop(nc, index);
+    asm_byte(as, 0xC3);                                                                              // ret
+
+    for (int i = 0; i < JIT_RUNTIME_COUNT; i++) {
+        asm_bind(as, *routines[i]);
+        asm_absolute(as, (const unsigned char[]) { 0xFF, 0x24, 0x25 }, 3, loop_data + 8 * (unsigned long long)i); // jmp [routine]
+    }
+    return ok && native_emit_tail(nc);
+}
+
+void native_compiler_free(NativeCompiler* nc) {
+    asm_free(&nc->as);
+    free(nc->slow_paths);
+    free(nc->literals);
+    free(nc->sites);
+}
+
+// Run a program that reads no input at compile time, since it writes the same output on
+// every run. Runs of the same command count as one step. Returns false if the program
+// has a ',', leaves the tape, takes too long or writes too much; otherwise *output holds
+// everything it writes.
+bool precompute_output(const char* code, BrainfuckConfig config, unsigned char** output, size_t* output_length) {
+    size_t length = strlen(code);
+    if (memchr(code, ',', length)) {
+        return false;
+    }
+    LoopInfo* loops = NULL;
+    size_t loop_count = 0;
+    if (!scan_loops(code, length, &loops, &loop_count)) {
+        return false;
+    }
+    size_t* match = (size_t*)malloc((length + 1) * sizeof(size_t));
+    unsigned char* tape = (unsigned char*)calloc(config.memory_size, 1);
+    unsigned char* out = (unsigned char*)malloc(MAX_PRECOMPUTED_OUTPUT);
+    bool done = match && tape && out;
+    for (size_t i = 0; done && i < loop_count; i++) {
+        match[loops[i].open] = loops[i].close;
+        match[loops[i].close] = loops[i].open;
+    }
+    free(loops);
+
+    size_t size = config.memory_size;
+    size_t ptr = 0;
+    size_t written = 0;
+    unsigned long long steps = 0;
+    for (size_t pos = 0; done && pos < length; pos++) {
+        if (++steps > MAX_PRECOMPUTE_STEPS) {
+            done = false;
+            break;
+        }
+        char c = code[pos];
+        size_t run = 1;
+        if (c == '+' || c == '-' || c == '>' || c == '<') {
+            while (pos + run < length && code[pos + run] == c) {
+                run++;
+            }
+            pos += run - 1;
+        }
+        switch (c) {
+        case '+':
+            tape[ptr] += (unsigned char)run;
+            break;
+        case '-':
+            tape[ptr] -= (unsigned char)run;
+            break;
+        case '>':
+            if (config.wrap_memory) {
+                ptr = (ptr + run % size) % size;
+            }
+            else if (run < size - ptr) {
+                ptr += run;
+            }
+            else {
+                done = false;
+            }
+            break;
+        case '<':
+            if (config.wrap_memory) {
+                ptr = (ptr + size - run % size) % size;
+            }
+            else if (run <= ptr) {
+                ptr -= run;
+            }
+            else {
+                done = false;
+            }
+            break;
+        case '.':
+            if (written == MAX_PRECOMPUTED_OUTPUT) {
+                done = false;
+                break;
+            }
+            out[written++] = tape[ptr];
+            break;
+        case '[':
+            if (tape[ptr] == 0) {
+                pos = match[pos];
+            }
+            break;
+        case ']':
+            if (tape[ptr] != 0) {
+                pos = match[pos];
+            }
+            break;
+        }
+    }
+    free(match);
+    free(tape);
+    if (!done) {
+        free(out);
+        return false;
+    }
+    *output = out;
+    *output_length = written;
+    return true;
+}
+
+// Emit an executable that writes precomputed output and exits. The output follows the code.
+bool native_emit_output(NativeCompiler* nc, const unsigned char* output, size_t output_length,
+    BrainfuckConfig config, unsigned long long data_address) {
+    memset(nc, 0, sizeof(*nc));
+    nc->as.ok = true;
+    nc->config = config;
+    nc->data_address = data_address;
+    nc->vector_width = 16;
+
+    Assembler* as = &nc->as;
+    size_t entry = asm_new_label(as);
+    size_t bytes = asm_new_label(as);
+    size_t loop = asm_new_label(as);
+    native_emit_runtime(nc);
+    asm_bind(as, entry);
+    asm_bytes(as, (const unsigned char[]) { 0x48, 0x8D, 0x35 }, 3);                               // lea rsi, [rip + bytes]
+    asm_label_ref(as, bytes, false);
+    asm_bytes(as, (const unsigned char[]) { 0xBA }, 1);                                            // mov edx, output_length
+    asm_u32(as, (unsigned int)output_length);
+    asm_bind(as, loop);
+    asm_bytes(as, (const unsigned char[]) { 0x48, 0x85, 0xD2 }, 3);                               // test rdx, rdx
+    asm_jcc(as, X86_JE, nc->rt_exit);
+    asm_bytes(as, (const unsigned char[]) { 0xB8, 1, 0, 0, 0, 0xBF, 1, 0, 0, 0, 0x0F, 0x05 }, 12); // write(1, rsi, rdx)
+    asm_bytes(as, (const unsigned char[]) { 0x48, 0x85, 0xC0 }, 3);                               // test rax, rax
+    asm_jcc(as, X86_JLE, nc->rt_exit);
+    asm_bytes(as, (const unsigned char[]) { 0x48, 0x01, 0xC6, 0x48, 0x29, 0xC2 }, 6);             // add rsi, rax; sub rdx, rax
+    asm_jump(as, X86_JMP, loop);
+    asm_bind(as, bytes);
+    asm_bytes(as, output, output_length);
+    return as->ok;
+}
+
+// Compile the whole program to native code and write it as a static Linux ELF executable.
+// A program that reads no input and finishes quickly is run here instead, and the
+// executable only writes its output; *precomputed is then set to the number of bytes.
+bool compile_to_exe(char* code, BrainfuckConfig config, const char* path, bool* precomputed, size_t* output_length) {
+    fit_tape(code, &config);
+    unsigned char* output = NULL;
+    *precomputed = precompute_output(code, config, &output, output_length);
+    NativeSource source;
+    memset(&source, 0, sizeof(source));
+    if (!*precomputed && !native_source_init(&source, code, &config)) {
+        return false;
+    }
+
+    // The data segment is placed after the code, so emit a first pass to learn its size
+    NativeCompiler nc;
+    bool ok = false;
+    unsigned long long data_address = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        ok = *precomputed ? native_emit_output(&nc, output, *output_length, config, data_address) :
+            native_emit_program(&nc, &source, code, config, data_address, false, 0, 0);
+        unsigned long long text_end = EXE_TEXT_ADDRESS + EXE_HEADERS_SIZE + nc.as.length;
+        data_address = ((text_end + 0xFFF) & ~0xFFFULL) + 0x1000;
+        if (pass == 0) {
+            native_compiler_free(&nc);
+        }
+        if (!ok) {
+            break;
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed while compiling\n");
+    }
+    else {
+        asm_finish(&nc.as, EXE_TEXT_ADDRESS + EXE_HEADERS_SIZE);
+
+        unsigned char headers[EXE_HEADERS_SIZE];
+        memset(headers, 0, sizeof(headers));
+        unsigned long long text_size = EXE_HEADERS_SIZE + nc.as.length;
+        memcpy(headers, "\x7F" "ELF", 4);
+        headers[4] = 2;                                       // 64-bit
+        headers[5] = 1;                                       // Little endian
+        headers[6] = 1;                                       // ELF version
+        put_u16(headers + 16, 2);                             // ET_EXEC
+        put_u16(headers + 18, 62);                            // EM_X86_64
+        put_u32(headers + 20, 1);
+        put_u64(headers + 24, EXE_TEXT_ADDRESS + EXE_HEADERS_SIZE + nc.as.labels[0]); // Entry point
+        put_u64(headers + 32, 64);                            // Program headers follow the ELF header
+        put_u16(headers + 52, 64);
+        put_u16(headers + 54, 56);
+        put_u16(headers + 56, 3);
+        put_u16(headers + 58, 64);
+        put_program_header(headers + 64, 1, 5, EXE_TEXT_ADDRESS, text_size, text_size);                 // Code: R+X
+        put_program_header(headers + 120, 1, 6, data_address, 0, EXE_TAPE + (unsigned long long)config.memory_size); // Data: R+W
+        put_program_header(headers + 176, 0x6474E551, 6, 0, 0, 0);                                     // Non-executable stack
+
+        FILE* file = NULL;
+        errno_t err = fopen_s(&file, path, "wb");
+        if (err != 0 || !file) {
+            fprintf(stderr, "Error: Could not open file %s\n", path);
+            ok = false;
+        }
+        else {
+            ok = fwrite(headers, 1, sizeof(headers), file) == sizeof(headers) &&
+                fwrite(nc.as.code, 1, nc.as.length, file) == nc.as.length;
+            if (fclose(file) != 0 || !ok) {
+                fprintf(stderr, "Error: Could not write file %s\n", path);
+                ok = false;
+            }
+#ifndef _WIN32
+            if (ok) {
+                chmod(path, 0755);
+            }
+#endif
+        }
+    }
+
+    native_compiler_free(&nc);
+    native_source_free(&source);
+    free(output);
+    return ok;
+}
+
+// Code memory for --jit. Each arena is a memfd mapped twice: code is written through a
+// read-write view and run through a read-execute view of the same pages, so no page is
+// ever writable and executable at once. Blocks of code (a program, or one of its loops)
+// are allocated one after another in an arena; generated code is position-independent,
+// so the space of freed blocks is reclaimed by sliding the live ones down. Past the cache
+// limit, the blocks run least recently are evicted.
+typedef struct {
+    int fd;
+    unsigned char* writable;
+    unsigned char* executable;
+    size_t size;
+    size_t used;  // Bytes allocated from the start, freed blocks included until compaction
+} CodeArena;
+
+typedef struct {
+    size_t arena;
+    size_t offset;
+    size_t size;
+    unsigned long long last_run;  // Cache clock when the block was last entered
+    const unsigned long long* stamp;  // Cache clock at its last entry, kept by the code itself; NULL if it does not
+    unsigned long long* pointer;  // Where the code's address is kept, updated when it moves; NULL for nowhere
+    unsigned long long evicted;   // Stored at pointer when the code is evicted
+    bool pinned;                  // Running: neither evicted nor moved
+    bool live;
+} CodeBlock;
+
+typedef struct {
+    CodeArena arenas[MAX_CODE_ARENAS];
+    size_t arena_count;
+    CodeBlock* blocks;  // Indexed by the ids code_cache_alloc returns
+    size_t block_count;
+    size_t block_capacity;
+    size_t limit;
+    size_t live_bytes;
+    size_t live_count;
+    unsigned long long clock;
+    unsigned long long evictions;
+    unsigned long long compactions;
+} CodeCache;
+
+void code_cache_init(CodeCache* cache, size_t limit) {
+    memset(cache, 0, sizeof(*cache));
+    cache->limit = limit;
+}
+
+#ifdef JIT_AVAILABLE
+void code_cache_destroy(CodeCache* cache) {
+    for (size_t i = 0; i < cache->arena_count; i++) {
+        CodeArena* arena = &cache->arenas[i];
+        munmap(arena->writable, arena->size);
+        munmap(arena->executable, arena->size);
+        close(arena->fd);
+    }
+    free(cache->blocks);
+    memset(cache, 0, sizeof(*cache));
+}
+
+bool code_arena_map(CodeArena* arena, size_t size) {
+    arena->fd = memfd_create("brainfuck-jit", MFD_CLOEXEC);
+    if (arena->fd < 0) {
+        return false;
+    }
+    arena->writable = MAP_FAILED;
+    arena->executable = MAP_FAILED;
+    if (ftruncate(arena->fd, (off_t)size) == 0) {
+        arena->writable = (unsigned char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, arena->fd, 0);
+        arena->executable = (unsigned char*)mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, arena->fd, 0);
+    }
+    if (arena->writable == MAP_FAILED || arena->executable == MAP_FAILED) {
+        if (arena->writable != MAP_FAILED) {
+            munmap(arena->writable, size);
+        }
+        if (arena->executable != MAP_FAILED) {
+            munmap(arena->executable, size);
+        }
+        close(arena->fd);
+        return false;
+    }
+    arena->size = size;
+    arena->used = 0;
+    return true;
+}
+
+void code_cache_free(CodeCache* cache, size_t id) {
+    CodeBlock* block = &cache->blocks[id];
+    if (!block->live) {
+        return;
+    }
+    block->live = false;
+    block->pinned = false;
+    cache->live_bytes -= block->size;
+    cache->live_count--;
+    CodeArena* arena = &cache->arenas[block->arena];
+    if (block->offset + block->size == arena->used) {
+        arena->used = block->offset;
+    }
+}
+
+// Slide the live blocks of every arena down over the space of freed ones, except
+// pinned ones, which stay where they are. Blocks are allocated in address order within
+// an arena, so they keep that order.
+void code_cache_compact(CodeCache* cache) {
+    for (size_t a = 0; a < cache->arena_count; a++) {
+        CodeArena* arena = &cache->arenas[a];
+        size_t end = 0;
+        for (size_t i = 0; i < cache->block_count; i++) {
+            CodeBlock* block = &cache->blocks[i];
+            if (!block->live || block->arena != a) {
+                continue;
+            }
+            if (block->offset != end && !block->pinned) {
+                memmove(arena->writable + end, arena->writable + block->offset, block->size);
+                block->offset = end;
+                if (block->pointer) {
+                    *block->pointer = (unsigned long long)(uintptr_t)(arena->executable + end);
+                }
+            }
+            end = block->offset + block->size;
+        }
+        arena->used = end;
+    }
+    cache->compactions++;
+}
+
+unsigned long long code_block_last_run(const CodeBlock* block) {
+    return block->stamp && *block->stamp > block->last_run ? *block->stamp : block->last_run;
+}
+
+// Allocate space for a block of size bytes; the id is valid until it is freed or evicted.
+// Sizes are rounded up to 16 bytes, so every block starts on a 16-byte boundary.
+bool code_cache_alloc(CodeCache* cache, size_t size, size_t* id) {
+    size = (size + 15) & ~(size_t)15;
+    if (size == 0) {
+        return false;
+    }
+    // Code that cannot fit under the limit even alone is still allocated, after evicting
+    // everything that can be
+    while (cache->live_bytes + size > cache->limit) {
+        size_t oldest = SIZE_MAX;
+        for (size_t i = 0; i < cache->block_count; i++) {
+            const CodeBlock* block = &cache->blocks[i];
+            if (block->live && !block->pinned &&
+                (oldest == SIZE_MAX || code_block_last_run(block) < code_block_last_run(&cache->blocks[oldest]))) {
+                oldest = i;
+            }
+        }
+        if (oldest == SIZE_MAX) {
+            break;
+        }
+        if (cache->blocks[oldest].pointer) {
+            *cache->blocks[oldest].pointer = cache->blocks[oldest].evicted;
+        }
+        code_cache_free(cache, oldest);
+        cache->evictions++;
+    }
+
+    // Room at the end of an arena, after compacting if freed space is in the way, or a new arena
+    size_t used = 0;
+    for (size_t a = 0; a < cache->arena_count; a++) {
+        used += cache->arenas[a].used;
+    }
+    size_t found = SIZE_MAX;
+    for (int attempt = 0; attempt < 2 && found == SIZE_MAX; attempt++) {
+        if (attempt == 1) {
+            if (used == cache->live_bytes) {
+                break;
+            }
+            code_cache_compact(cache);
+        }
+        for (size_t a = 0; a < cache->arena_count && found == SIZE_MAX; a++) {
+            if (cache->arenas[a].size - cache->arenas[a].used >= size) {
+                found = a;
+            }
+        }
+    }
+    if (found == SIZE_MAX) {
+        // Arenas are no larger than the cache needs, rounded up to whole pages
+        size_t arena_size = JIT_ARENA_SIZE;
+        if (cache->limit < arena_size) {
+            arena_size = (cache->limit + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+        }
+        while (arena_size < size) {
+            arena_size *= 2;
+        }
+        if (cache->arena_count == MAX_CODE_ARENAS || !code_arena_map(&cache->arenas[cache->arena_count], arena_size)) {
+            return false;
+        }
+        found = cache->arena_count++;
+    }
+
+    if (cache->block_count == cache->block_capacity) {
+        size_t new_capacity = cache->block_capacity ? cache->block_capacity * 2 : 16;
+        CodeBlock* grown = (CodeBlock*)realloc(cache->blocks, new_capacity * sizeof(CodeBlock));
+        if (!grown) {
+            return false;
+        }
+        cache->blocks = grown;
+        cache->block_capacity = new_capacity;
+    }
+    CodeArena* arena = &cache->arenas[found];
+    CodeBlock* block = &cache->blocks[cache->block_count];
+    block->arena = found;
+    block->offset = arena->used;
+    block->size = size;
+    block->last_run = cache->clock;
+    block->stamp = NULL;
+    block->pointer = NULL;
+    block->evicted = 0;
+    block->pinned = false;
+    block->live = true;
+    arena->used += size;
+    cache->live_bytes += size;
+    cache->live_count++;
+    *id = cache->block_count++;
+    return true;
+}
+
+unsigned char* code_cache_writable(CodeCache* cache, size_t id) {
+    const CodeBlock* block = &cache->blocks[id];
+    return cache->arenas[block->arena].writable + block->offset;
+}
+
+// Executable address of a block about to run
+unsigned char* code_cache_enter(CodeCache* cache, size_t id) {
+    CodeBlock* block = &cache->blocks[id];
+    block->last_run = ++cache->clock;
+    return cache->arenas[block->arena].executable + block->offset;
+}
+
+void print_code_cache(const CodeCache* cache) {
+    size_t mapped = 0;
+    size_t used = 0;
+    for (size_t i = 0; i < cache->arena_count; i++) {
+        mapped += cache->arenas[i].size;
+        used += cache->arenas[i].used;
+    }
+    fprintf(stderr, "JIT code: %zu blocks, %zu bytes live, %zu of %zu bytes used in %zu arenas (%.1f%%), "
+        "%llu evicted, %llu compactions\n", cache->live_count, cache->live_bytes, used, mapped, cache->arena_count,
+        mapped ? 100.0 * used / mapped : 0.0, cache->evictions, cache->compactions);
+}
+
+// Breakpoint hit in JIT code, recorded by the SIGTRAP handler
+typedef struct {
+    volatile bool hit;
+    volatile uintptr_t address;  // Of the int3
+    volatile uintptr_t pointer;  // rbx, the data pointer
+    uintptr_t resume;            // rt_exit, which flushes the output and returns to jit_run
+} JitTrap;
+
+static JitTrap jit_trap;
+
+void jit_trap_handler(int signal, siginfo_t* info, void* context) {
+    (void)signal;
+    (void)info;
+    ucontext_t* uc = (ucontext_t*)context;
+    jit_trap.address = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP] - 1;
+    jit_trap.pointer = (uintptr_t)uc->uc_mcontext.gregs[REG_RBX];
+    jit_trap.hit = true;
+    uc->uc_mcontext.gregs[REG_RIP] = (greg_t)jit_trap.resume;
+}
+
+// Put an int3 on the site each breakpoint is reached through: the last one execution
+// passes on the way there, the end of a loop just before it or the start of a loop
+// around it. Returns false if a breakpoint comes before every site, so that the whole
+// program has to be interpreted.
+bool jit_set_breakpoints(const char* code, const NativeCompiler* nc, const BrainfuckConfig* config,
+    unsigned char* writable) {
+    size_t length = strlen(code);
+    bool* has_site = (bool*)calloc(length + 2, sizeof(bool));
+    if (!has_site) {
+        return false;
+    }
+    for (size_t i = 0; i < nc->site_count; i++) {
+        has_site[nc->sites[i].pos] = true;
+    }
+
+    bool found = true;
+    for (size_t b = 0; b < config->breakpoint_count && found; b++) {
+        size_t pos = config->breakpoints[b];
+        while (pos > 0 && !has_site[pos]) {
+            if (code[pos - 1] == ']') {
+                // Skip loops compiled without sites, such as multiply loops
+                size_t nest_level = 1;
+                pos--;
+                while (nest_level > 0) {
+                    pos--;
+                    if (code[pos] == ']') {
+                        nest_level++;
+                    }
+                    else if (code[pos] == '[') {
+                        nest_level--;
+                    }
+                }
+            }
+            else {
+                pos--;
+            }
+        }
+        found = pos > 0;
+        for (size_t i = 0; found && i < nc->site_count; i++) {
+            if (nc->sites[i].pos == pos) {
+                writable[nc->as.labels[nc->sites[i].label]] = 0xCC;  // int3
+            }
         }
     }
-    printf("\n");
+    free(has_site);
+    return found;
 }
 
-// Function to execute brainfuck code with configuration
-void execute_brainfuck(char* code, BrainfuckConfig config) {
-    // Allocate memory for the tape
-    unsigned char* memory = (unsigned char*)calloc(config.memory_size, sizeof(unsigned char));
-    if (!memory) {
-        fprintf(stderr, "Error: Memory allocation failed\n");
+// Continue a program stopped at a breakpoint in the interpreter, from the source position
+// of its site, with the tape, data pointer and input line the native code left
+void jit_deoptimize(const char* code, const NativeCompiler* nc, const BrainfuckConfig* config,
+    unsigned char* data, const unsigned char* executable) {
+    size_t pos = SIZE_MAX;
+    for (size_t i = 0; i < nc->site_count; i++) {
+        if ((uintptr_t)(executable + nc->as.labels[nc->sites[i].label]) == jit_trap.address) {
+            pos = nc->sites[i].pos;
+        }
+    }
+    if (pos == SIZE_MAX) {
         return;
     }
+    printf("\n[DEBUG] Left native code at position %zu\n", pos);
 
-    unsigned char* ptr = memory; // Data pointer
+    InputBuffer input;
+    memcpy(&input.size, data + EXE_LINE_LENGTH, sizeof(input.size));
+    memcpy(&input.pos, data + EXE_LINE_POS, sizeof(input.pos));
+    memcpy(input.data, data + EXE_LINE_BUFFER, input.size);
+    unsigned char* ptr = (unsigned char*)jit_trap.pointer;
+    execute_range(code, pos, strlen(code), data + EXE_TAPE, &ptr, config, &input);
+}
 
-    // Program counter
-    size_t pc = 0;
-    size_t code_length = strlen(code);
+// Outermost loops of the program --jit is running, compiled the first time they run
+typedef struct {
+    NativeSource* source;
+    const char* code;
+    BrainfuckConfig config;
+    CodeCache* cache;
+    unsigned long long data_address;
+    unsigned long long* loop_data;
+    size_t* ids;               // Code cache id of each loop's code, SIZE_MAX if it has none
+    unsigned long long compile;  // rt_compile, where the slot of a loop without code points
+    unsigned long long exit;     // rt_exit, run instead of a loop that cannot be compiled
+} JitLoops;
 
-    // Stack to keep track of loop positions
-    size_t* loop_stack = (size_t*)malloc(MAX_NESTED_LOOPS * sizeof(size_t));
-    if (!loop_stack) {
-        fprintf(stderr, "Error: Memory allocation failed for loop stack\n");
-        free(memory);
-        return;
+static JitLoops jit_loops;
+
+// Called through rt_compile when an outermost loop runs for the first time, or again
+// after its code was evicted. Compiles the loop, points its slot at the code and
+// returns the code's address for rt_compile to jump to.
+unsigned long long jit_compile_loop(unsigned int index) {
+    JitLoops* jl = &jit_loops;
+    CodeCache* cache = jl->cache;
+    unsigned long long loop_data = (unsigned long long)(uintptr_t)jl->loop_data;
+    unsigned long long* slot = jl->loop_data + (JIT_LOOP_SLOTS + JIT_LOOP_SLOT_SIZE * index) / 8;
+    // Loops stamp the clock in the loop data, so the cache goes by it in choosing what to evict
+    cache->clock = jl->loop_data[JIT_CLOCK / 8];
+
+    NativeCompiler nc;
+    size_t id = 0;
+    bool ok = native_emit_loop_program(&nc, jl->source, jl->code, jl->config, jl->data_address, loop_data, index);
+    if (ok) {
+        asm_finish(&nc.as, 0);
+        ok = code_cache_alloc(cache, nc.as.length, &id);
     }
+    unsigned long long address = jl->exit;
+    if (ok) {
+        memcpy(code_cache_writable(cache, id), nc.as.code, nc.as.length);
+        CodeBlock* block = &cache->blocks[id];
+        block->pointer = slot;
+        block->evicted = jl->compile;
+        block->stamp = slot + 1;
+        address = (unsigned long long)(uintptr_t)code_cache_enter(cache, id);
+        *slot = address;
+        jl->ids[index] = id;
+        jl->loop_data[JIT_CLOCK / 8] = cache->clock;
+    }
+    else {
+        fprintf(stderr, "Error: Could not compile the loop at position %zu for the JIT\n",
+            jl->source->loops[index].open + 1);
+    }
+    native_compiler_free(&nc);
+    return address;
+}
 
-    size_t stack_pos = 0;
+// Compile the program to native code and run it in this process. Returns false, having
+// run nothing, if that is not possible; the program is then left to the interpreter.
+// Outermost loops are compiled the first time they run, each with the loops inside it,
+// and may be evicted from the code cache and compiled again later. With breakpoints,
+// the whole program is compiled up front and runs natively until it reaches one, and
+// the interpreter takes over from there.
+bool jit_run(char* code, BrainfuckConfig config, CodeCache* cache) {
+    fit_tape(code, &config);
 
-    // Input buffer setup
-    char input_buffer[INPUT_BUFFER_SIZE];
-    size_t input_pos = 0;
-    size_t input_size = 0;
+    NativeSource source;
+    if (!native_source_init(&source, code, &config)) {
+        return true; // The error is reported, as the interpreter would
+    }
 
-    // Execute the code
-    while (pc < code_length) {
-        char instruction = code[pc];
+    // The runtime addresses its variables with 32-bit absolute addresses, so the data
+    // segment has to be in the low 2 GB
+    bool lazy = config.breakpoint_count == 0;
+    size_t data_size = lazy ? JIT_LOOP_DATA(config.memory_size) + JIT_LOOP_SLOTS + JIT_LOOP_SLOT_SIZE * source.loop_count
+        : EXE_TAPE + (size_t)config.memory_size;
+    unsigned char* data = (unsigned char*)mmap(NULL, data_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Warning: Could not map JIT data below 2 GB, interpreting instead\n");
+        native_source_free(&source);
+        return false;
+    }
+    unsigned long long data_address = (unsigned long long)(uintptr_t)data;
+    unsigned long long* loop_data = lazy ? (unsigned long long*)(data + JIT_LOOP_DATA(config.memory_size)) : NULL;
+    size_t* ids = lazy ? (size_t*)malloc((source.loop_count + 1) * sizeof(size_t)) : NULL;
 
-        if (config.debug_mode) {
-            print_debug_state(memory, ptr, config.memory_size, pc, instruction);
+    NativeCompiler nc;
+    size_t id = 0;
+    bool ok = native_emit_program(&nc, &source, code, config, data_address, true,
+        (unsigned long long)(uintptr_t)loop_data, (unsigned long long)(uintptr_t)jit_compile_loop);
+    if (ok && lazy) {
+        ok = ids != NULL;
+    }
+    if (ok) {
+        asm_finish(&nc.as, 0);
+        ok = code_cache_alloc(cache, nc.as.length, &id);
+    }
+    if (ok) {
+        memcpy(code_cache_writable(cache, id), nc.as.code, nc.as.length);
+        ok = !nc.debuggable || jit_set_breakpoints(code, &nc, &config, code_cache_writable(cache, id));
+        if (!ok) {
+            code_cache_free(cache, id);  // Interpreted from the start, with no warning
         }
-
-        switch (instruction) {
-        case '>': // Increment data pointer
-            if (config.wrap_memory) {
-                ptr = (ptr == memory + config.memory_size - 1) ? memory : ptr + 1;
-            }
-            else if (ptr < memory + config.memory_size - 1) {
-                ptr++;
-            }
-            else {
-                fprintf(stderr, "Error: Data pointer out of bounds at position %zu\n", pc);
-                free(memory);
-                free(loop_stack);
-                return;
+    }
+    else {
+        fprintf(stderr, "Warning: Could not compile the program for the JIT, interpreting instead\n");
+    }
+    if (ok) {
+        unsigned char* executable = code_cache_enter(cache, id);
+        if (lazy) {
+            // Loops are compiled while this code runs, so it must stay where it is
+            cache->blocks[id].pinned = true;
+            size_t* routines[JIT_RUNTIME_COUNT];
+            native_runtime_labels(&nc, routines);
+            for (int i = 0; i < JIT_RUNTIME_COUNT; i++) {
+                loop_data[i] = (unsigned long long)(uintptr_t)(executable + nc.as.labels[*routines[i]]);
             }
-            break;
-
-        case '<': // Decrement data pointer
-            if (config.wrap_memory) {
-                ptr = (ptr == memory) ? memory + config.memory_size - 1 : ptr - 1;
+            loop_data[JIT_CLOCK / 8] = cache->clock;
+            unsigned long long compile = (unsigned long long)(uintptr_t)(executable + nc.as.labels[nc.rt_compile]);
+            for (size_t i = 0; i < source.loop_count; i++) {
+                loop_data[(JIT_LOOP_SLOTS + JIT_LOOP_SLOT_SIZE * i) / 8] = compile;
+                ids[i] = SIZE_MAX;
             }
-            else if (ptr > memory) {
-                ptr--;
+            jit_loops.source = &source;
+            jit_loops.code = code;
+            jit_loops.config = config;
+            jit_loops.cache = cache;
+            jit_loops.data_address = data_address;
+            jit_loops.loop_data = loop_data;
+            jit_loops.ids = ids;
+            jit_loops.compile = compile;
+            jit_loops.exit = (unsigned long long)(uintptr_t)(executable + nc.as.labels[nc.rt_exit]);
+        }
+        void (*entry)(void) = (void (*)(void))(executable + nc.as.labels[0]);
+        struct sigaction trap_action;
+        struct sigaction saved_action;
+        if (nc.debuggable) {
+            memset(&trap_action, 0, sizeof(trap_action));
+            trap_action.sa_sigaction = jit_trap_handler;
+            trap_action.sa_flags = SA_SIGINFO;
+            sigemptyset(&trap_action.sa_mask);
+            jit_trap.hit = false;
+            jit_trap.resume = (uintptr_t)(executable + nc.as.labels[nc.rt_exit]);
+            sigaction(SIGTRAP, &trap_action, &saved_action);
+        }
+        fflush(stdout);  // The program writes to the file descriptor directly
+        entry();
+        if (nc.debuggable) {
+            sigaction(SIGTRAP, &saved_action, NULL);
+            if (jit_trap.hit) {
+                jit_deoptimize(code, &nc, &config, data, executable);
             }
-            else {
-                fprintf(stderr, "Error: Data pointer out of bounds at position %zu\n", pc);
-                free(memory);
-                free(loop_stack);
-                return;
+        }
+        if (config.profile) {
+            print_code_cache(cache);
+            fprintf(stderr, "Warning: Native code does not count instructions; run without --jit for the full profile\n");
+        }
+        for (size_t i = 0; lazy && i < source.loop_count; i++) {
+            if (ids[i] != SIZE_MAX) {
+                code_cache_free(cache, ids[i]);  // No-op if it was evicted
             }
-            break;
+        }
+        code_cache_free(cache, id);
+    }
 
-        case '+': // Increment value at data pointer
-            (*ptr)++;
-            break;
+    free(ids);
+    native_compiler_free(&nc);
+    native_source_free(&source);
+    munmap(data, data_size);
+    return ok;
+}
+#else
+void code_cache_destroy(CodeCache* cache) {
+    (void)cache;
+}
 
-        case '-': // Decrement value at data pointer
-            (*ptr)--;
-            break;
+bool jit_run(char* code, BrainfuckConfig config, CodeCache* cache) {
+    (void)code;
+    (void)config;
+    (void)cache;
+    fprintf(stderr, "Warning: --jit needs Linux on x86-64, interpreting instead\n");
+    return false;
+}
+#endif
 
-        case '.': // Output value at data pointer
-            putchar(*ptr);
-            fflush(stdout);
-            break;
+// Source-to-source minifier for --emit-bf
 
-        case ',': // Input value and store at data pointer
-            // If input buffer is empty or we've used all buffered input, refill it
-            if (input_pos >= input_size) {
-                input_size = 0;
-                input_pos = 0;
+// Minified program being written. Additions and moves are held back so that runs
+// (and pairs such as "+-" or "<>") collapse to their net effect.
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int add;
+    long long move;
+    bool ok;
+} BfWriter;
 
-                // Prompt for input only in interactive mode
-                if (_isatty(_fileno(stdin))) {
-                    printf("\nInput: ");
-                    fflush(stdout);
-                }
+void bf_put(BfWriter* w, char c, size_t count) {
+    if (w->length + count + 1 > w->capacity) {
+        size_t new_capacity = w->capacity ? w->capacity : 256;
+        while (new_capacity < w->length + count + 1) {
+            new_capacity *= 2;
+        }
+        char* grown = (char*)realloc(w->data, new_capacity);
+        if (!grown) {
+            w->ok = false;
+            return;
+        }
+        w->data = grown;
+        w->capacity = new_capacity;
+    }
+    memset(w->data + w->length, c, count);
+    w->length += count;
+    w->data[w->length] = '\0';
+}
+
+// Characters needed to add delta to a cell: the shorter of the '+' and '-' forms
+int bf_add_cost(int delta) {
+    int value = delta & 0xFF;
+    return value <= 128 ? value : 256 - value;
+}
+
+void bf_flush(BfWriter* w) {
+    int value = w->add & 0xFF;
+    if (value != 0) {
+        bf_put(w, value <= 128 ? '+' : '-', (size_t)bf_add_cost(value));
+    }
+    if (w->move != 0) {
+        bf_put(w, w->move > 0 ? '>' : '<', (size_t)(w->move > 0 ? w->move : -w->move));
+    }
+    w->add = 0;
+    w->move = 0;
+}
+
+void bf_add(BfWriter* w, int delta) {
+    if (w->move != 0) {
+        bf_flush(w);
+    }
+    w->add = (w->add + delta) & 0xFF;
+}
+
+void bf_move(BfWriter* w, long long delta) {
+    if (w->add != 0) {
+        bf_flush(w);
+    }
+    w->move += delta;
+}
+
+void bf_emit(BfWriter* w, char c) {
+    bf_flush(w);
+    bf_put(w, c, 1);
+}
 
-                if (fgets(input_buffer, INPUT_BUFFER_SIZE, stdin) != NULL) {
-                    input_size = strlen(input_buffer);
+// Write code that sets cells 0..high of a zero tape to the given values and leaves the
+// pointer at cell at. Each cell is set directly or, when shorter, by a multiply loop
+// counting down the (still zero) next cell, if that is on the tape.
+void bf_set_cells(BfWriter* w, const unsigned char* tape, size_t high, size_t at, size_t memory_size) {
+    size_t here = 0;
+    for (size_t i = 0; i <= high; i++) {
+        int value = tape[i];
+        if (value == 0) {
+            continue;
+        }
+        bf_move(w, (long long)i - (long long)here);
+        here = i;
+        int best = bf_add_cost(value);
+        int best_count = 0;
+        int best_step = 0;
+        for (int count = 2; i + 1 < memory_size && count <= 32; count++) {
+            for (int step = -40; step <= 40; step++) {
+                int cost = count + (step < 0 ? -step : step) + bf_add_cost(value - count * step) + 7;
+                if (step != 0 && cost < best) {
+                    best = cost;
+                    best_count = count;
+                    best_step = step;
                 }
             }
+        }
+        if (best_count > 0) {
+            bf_move(w, 1);
+            bf_add(w, best_count);
+            bf_emit(w, '[');
+            bf_move(w, -1);
+            bf_add(w, best_step);
+            bf_move(w, 1);
+            bf_add(w, -1);
+            bf_emit(w, ']');
+            bf_move(w, -1);
+        }
+        bf_add(w, value - best_count * best_step);
+    }
+    bf_move(w, (long long)at - (long long)here);
+}
 
-            // Handle input
-            if (input_pos < input_size) {
-                *ptr = (unsigned char)input_buffer[input_pos++];
-            }
-            else {
-                // EOF condition
-                if (config.eof_behavior) {
-                    *ptr = 0; // Set to 0 on EOF
-                }
-                // Otherwise leave the cell unchanged
+// Copy code[start, end) with runs collapsed and loops removed where the current cell is
+// known to be 0: right after another loop, or at start if zero_at_start is set
+void bf_copy(BfWriter* w, const char* code, const size_t* match, size_t start, size_t end, bool zero_at_start) {
+    bool zero = zero_at_start;
+    for (size_t pos = start; pos < end; pos++) {
+        switch (code[pos]) {
+        case '+':
+        case '-':
+            bf_add(w, code[pos] == '+' ? 1 : -1);
+            zero = false;
+            break;
+        case '>':
+        case '<':
+            bf_move(w, code[pos] == '>' ? 1 : -1);
+            zero = false;
+            break;
+        case '[':
+            if (zero) {
+                pos = match[pos];
+                break;
             }
+            bf_emit(w, '[');
+            zero = false;
+            break;
+        case ']':
+            bf_emit(w, ']');
+            zero = true;
             break;
+        default:
+            bf_emit(w, code[pos]);
+            zero = false;
+            break;
+        }
+    }
+}
 
-        case '[': // Start of loop
-            if (*ptr == 0) {
-                // Skip to matching ']'
-                size_t nest_level = 1;
-                while (nest_level > 0) {
-                    pc++;
-                    if (pc >= code_length) {
-                        fprintf(stderr, "Error: Unmatched '[' at position %zu\n",
-                            stack_pos > 0 ? loop_stack[stack_pos - 1] : pc);
-                        free(memory);
-                        free(loop_stack);
-                        return;
-                    }
-                    if (code[pc] == '[') {
-                        nest_level++;
-                    }
-                    else if (code[pc] == ']') {
-                        nest_level--;
-                    }
-                }
+// Run the loop-free and I/O-free start of the program at compile time. Whole top-level
+// commands are run on the tape (which starts at 0) until one reads or writes, leaves the
+// tape or takes too long. Returns where the rest of the program starts.
+size_t fold_program_start(const char* code, size_t length, const size_t* match, unsigned char* tape,
+    size_t memory_size, size_t* ptr_out, size_t* high_out) {
+    size_t ptr = 0;
+    size_t high = 0;
+    unsigned long long steps = 0;
+    size_t pos = 0;
+    for (; pos < length; pos++) {
+        char c = code[pos];
+        if (c == '.' || c == ',') {
+            break;
+        }
+        if (c == '+' || c == '-') {
+            tape[ptr] += (c == '+') ? 1 : -1;
+            continue;
+        }
+        if (c == '>' || c == '<') {
+            if ((c == '<' && ptr == 0) || (c == '>' && ptr + 1 >= memory_size)) {
+                break;
             }
-            else {
-                // Push current position onto stack
-                if (stack_pos >= MAX_NESTED_LOOPS) {
-                    fprintf(stderr, "Error: Too many nested loops (max %d)\n", MAX_NESTED_LOOPS);
-                    free(memory);
-                    free(loop_stack);
-                    return;
+            ptr += (c == '>') ? 1 : -1;
+            high = ptr > high ? ptr : high;
+            continue;
+        }
+
+        // A loop: run it on its own, then keep or undo its effect
+        size_t close = match[pos];
+        if (memchr(code + pos, '.', close - pos) || memchr(code + pos, ',', close - pos)) {
+            break;
+        }
+        unsigned char* saved = (unsigned char*)malloc(high + 1);
+        if (!saved) {
+            break;
+        }
+        memcpy(saved, tape, high + 1);
+        size_t loop_ptr = ptr;
+        size_t loop_high = high;
+        bool done = true;
+        for (size_t ip = pos; ip <= close; ip++) {
+            if (++steps > MAX_FOLD_STEPS) {
+                done = false;
+                break;
+            }
+            switch (code[ip]) {
+            case '+':
+                tape[loop_ptr]++;
+                break;
+            case '-':
+                tape[loop_ptr]--;
+                break;
+            case '>':
+                done = loop_ptr + 1 < memory_size;
+                if (done) {
+                    loop_ptr++;
+                    loop_high = loop_ptr > loop_high ? loop_ptr : loop_high;
                 }
-                loop_stack[stack_pos++] = pc;
+                break;
+            case '<':
+                done = loop_ptr > 0;
+                if (done) {
+                    loop_ptr--;
+                }
+                break;
+            case '[':
+                if (tape[loop_ptr] == 0) {
+                    ip = match[ip];
+                }
+                break;
+            case ']':
+                if (tape[loop_ptr] != 0) {
+                    ip = match[ip];
+                }
+                break;
             }
+            if (!done) {
+                break;
+            }
+        }
+        if (!done) {
+            memcpy(tape, saved, high + 1);
+            memset(tape + high + 1, 0, loop_high - high);
+            free(saved);
             break;
+        }
+        free(saved);
+        ptr = loop_ptr;
+        high = loop_high;
+        pos = close;
+    }
+    *ptr_out = ptr;
+    *high_out = high;
+    return pos;
+}
 
-        case ']': // End of loop
-            if (stack_pos <= 0) {
-                fprintf(stderr, "Error: Unmatched ']' at position %zu\n", pc);
-                free(memory);
-                free(loop_stack);
-                return;
+// Write an equivalent program with the start folded into constant cell setup, runs
+// collapsed, loops that can never run removed and all comments dropped. Moves off the
+// tape are assumed not to happen, as "<>" and the like are cancelled.
+bool emit_bf(char* code, BrainfuckConfig config, const char* path, size_t* written) {
+    size_t length = strlen(code);
+    LoopInfo* loops = NULL;
+    size_t loop_count = 0;
+    if (!scan_loops(code, length, &loops, &loop_count)) {
+        return false;
+    }
+    size_t* match = (size_t*)malloc((length + 1) * sizeof(size_t));
+    unsigned char* tape = (unsigned char*)calloc(config.memory_size, 1);
+    if (!match || !tape) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        free(match);
+        free(tape);
+        free(loops);
+        return false;
+    }
+    for (size_t i = 0; i < loop_count; i++) {
+        match[loops[i].open] = loops[i].close;
+        match[loops[i].close] = loops[i].open;
+    }
+    free(loops);
+
+    // Either the folded start followed by the rest, or the whole program as it is
+    size_t ptr = 0;
+    size_t high = 0;
+    size_t rest = fold_program_start(code, length, match, tape, config.memory_size, &ptr, &high);
+    BfWriter folded = { .ok = true };
+    bf_set_cells(&folded, tape, high, ptr, config.memory_size);
+    bf_copy(&folded, code, match, rest, length, tape[ptr] == 0);
+    BfWriter plain = { .ok = true };
+    bf_copy(&plain, code, match, 0, length, true);
+    free(match);
+    free(tape);
+
+    // Trailing additions and moves have no visible effect
+    folded.add = 0;
+    folded.move = 0;
+    plain.add = 0;
+    plain.move = 0;
+    bool ok = folded.ok && plain.ok;
+    const BfWriter* best = (folded.length <= plain.length) ? &folded : &plain;
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+    }
+    else {
+        FILE* file = NULL;
+        errno_t err = fopen_s(&file, path, "w");
+        if (err != 0 || !file) {
+            fprintf(stderr, "Error: Could not open file %s\n", path);
+            ok = false;
+        }
+        else {
+            ok = fwrite(best->data ? best->data : "", 1, best->length, file) == best->length && fputc('\n', file) != EOF;
+            if (fclose(file) != 0 || !ok) {
+                fprintf(stderr, "Error: Could not write file %s\n", path);
+                ok = false;
             }
+        }
+        *written = best->length;
+    }
+    free(folded.data);
+    free(plain.data);
+    return ok;
+}
 
-            if (*ptr != 0) {
-                // Jump back to matching '['
-                pc = loop_stack[stack_pos - 1];
+// Search rewrites for the program's loops and add them to the database at path. With
+// --profile-in the loops that ran the most iterations are searched first and loops that
+// never ran are left out. Multiply loops, which the compiler already rewrites, and loops
+// the database has are skipped.
+bool superoptimize(char* code, BrainfuckConfig config, const char* path, size_t* found, size_t* searched) {
+    size_t length = strlen(code);
+    LoopInfo* loops = NULL;
+    size_t loop_count = 0;
+    if (!scan_loops(code, length, &loops, &loop_count)) {
+        return false;
+    }
+    LoopProfile* profiled = config.profile_in ? load_loop_profile(config.profile_in, code, loops, loop_count) : NULL;
+    unsigned long long* weights = (unsigned long long*)calloc(loop_count + 1, sizeof(unsigned long long));
+    bool* listed = (bool*)calloc(loop_count + 1, sizeof(bool));
+    size_t* candidates = (size_t*)malloc((loop_count + 1) * sizeof(size_t));
+    Rewrite* rewrites = (Rewrite*)malloc(MAX_SUPER_CANDIDATES * sizeof(Rewrite));
+    char* kept = NULL;
+    size_t kept_length = 0;
+    bool ok = weights && listed && candidates && rewrites;
+    if (!ok) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+    }
+
+    // Keep the rewrites already in the database
+    FILE* file = NULL;
+    LoopTable table = { NULL, 0 };
+    if (ok && fopen_s(&file, path, "r") == 0 && file) {
+        ok = index_rewrite_loops(&table, loops, loop_count);
+        int version = 0;
+        if (ok && (fscanf(file, "bf-rewrites %d\n", &version) != 1 || version != 1)) {
+            fprintf(stderr, "Error: %s is not a rewrite database\n", path);
+            ok = false;
+        }
+        char line[REWRITE_LINE_SIZE];
+        while (ok && fgets(line, sizeof(line), file)) {
+            size_t line_length = strlen(line);
+            char* grown = (char*)realloc(kept, kept_length + line_length + 1);
+            if (!grown) {
+                fprintf(stderr, "Error: Memory allocation failed\n");
+                ok = false;
+                break;
             }
-            else {
-                // Exit the loop
-                stack_pos--;
+            kept = grown;
+            memcpy(kept + kept_length, line, line_length + 1);
+            kept_length += line_length;
+            size_t index = find_rewrite_loop(&table, code, loops, loop_count, line, rewrite_key_length(line));
+            if (index < loop_count) {
+                listed[index] = true;
             }
-            break;
         }
+        free(table.slots);
+        fclose(file);
+    }
 
-        pc++;
+    size_t candidate_count = 0;
+    if (ok) {
+        for (size_t i = 0; i < loop_count; i++) {
+            if (loops[i].profile) {
+                weights[loops[i].shared] += loops[i].profile->iterations;
+            }
+        }
+        int targets[MAX_PENDING_ADDS];
+        int factors[MAX_PENDING_ADDS];
+        int target_count;
+        int low;
+        int high;
+        for (size_t i = 0; i < loop_count; i++) {
+            if (loops[i].shared == i && !listed[i] && (!profiled || weights[i] > 0) &&
+                !parse_multiply_loop(code, loops[i].open, loops[i].close, targets, factors, &target_count, &low, &high)) {
+                candidates[candidate_count++] = i;
+            }
+        }
+        // Hottest first
+        for (size_t k = 0; profiled && k < candidate_count && k < MAX_SUPER_CANDIDATES; k++) {
+            size_t best = k;
+            for (size_t i = k + 1; i < candidate_count; i++) {
+                if (weights[candidates[i]] > weights[candidates[best]]) {
+                    best = i;
+                }
+            }
+            size_t swap = candidates[k];
+            candidates[k] = candidates[best];
+            candidates[best] = swap;
+        }
+        if (candidate_count > MAX_SUPER_CANDIDATES) {
+            candidate_count = MAX_SUPER_CANDIDATES;
+        }
     }
 
-    // Check if all loops are closed
-    if (stack_pos != 0) {
-        fprintf(stderr, "Error: %zu unclosed loops\n", stack_pos);
+    *found = 0;
+    *searched = candidate_count;
+    for (size_t k = 0; ok && k < candidate_count; k++) {
+        if (superoptimize_loop(code, &loops[candidates[k]], &rewrites[*found])) {
+            candidates[(*found)++] = candidates[k];
+        }
     }
 
-    // Free the allocated memory
-    free(memory);
-    free(loop_stack);
+    if (ok) {
+        file = NULL;
+        errno_t err = fopen_s(&file, path, "w");
+        if (err != 0 || !file) {
+            fprintf(stderr, "Error: Could not write file %s\n", path);
+            ok = false;
+        }
+        else {
+            fprintf(file, "bf-rewrites 1\n");
+            if (kept) {
+                fputs(kept, file);
+                if (kept[kept_length - 1] != '\n') {
+                    fputc('\n', file);
+                }
+            }
+            for (size_t k = 0; k < *found; k++) {
+                write_rewrite(file, code, &loops[candidates[k]], &rewrites[k]);
+            }
+            if (fclose(file) != 0) {
+                fprintf(stderr, "Error: Could not write file %s\n", path);
+                ok = false;
+            }
+        }
+    }
+    free(kept);
+    free(rewrites);
+    free(candidates);
+    free(listed);
+    free(weights);
+    free(profiled);
+    free(loops);
+    return ok;
 }
 
 // Function to filter out non-brainfuck characters
@@ -246,6 +6145,17 @@ void print_usage(const char* program_name) {
     printf("  -d           Enable debug mode\n");
     printf("  -m <size>    Set memory size (default: %d)\n", DEFAULT_MEMORY_SIZE);
     printf("  -z           Set cell to 0 on EOF (default: leave unchanged)\n");
+    printf("  --compile-to-exe <file>  Write a standalone Linux x86-64 executable instead of running\n");
+    printf("  --emit-bf <file>  Write a minimized equivalent program instead of running\n");
+    printf("  --profile    Report the most frequently executed instruction sequences\n");
+    printf("  --memo       Remember the results of loops that only touch a few cells\n");
+    printf("  --profile-out <file>  Save how often each loop ran\n");
+    printf("  --profile-in <file>   Optimize using loop counts saved by --profile-out\n");
+    printf("  --superoptimize <file>  Search for faster equivalents of loops and add them to a rewrite file\n");
+    printf("  --rewrites <file>     Use the loop rewrites saved by --superoptimize\n");
+    printf("  --jit        Compile to native code and run it directly (Linux x86-64)\n");
+    printf("  --jit-cache <bytes>  Most bytes of --jit code kept (default: %d)\n", JIT_CACHE_LIMIT);
+    printf("  --break <pos>  Start debug output when the program reaches position pos (may be repeated)\n");
     printf("\nExample: %s -w -m 100000 program.bf\n", program_name);
     system("pause");
 }
@@ -261,10 +6171,22 @@ int main(int argc, char* argv[]) {
         .wrap_memory = false,
         .debug_mode = false,
         .memory_size = DEFAULT_MEMORY_SIZE,
-        .eof_behavior = false
+        .eof_behavior = false,
+        .profile = false,
+        .memo = false,
+        .profile_out = NULL,
+        .profile_in = NULL,
+        .rewrites = NULL,
+        .jit = false,
+        .jit_cache = JIT_CACHE_LIMIT,
+        .breakpoint_count = 0
     };
 
     // Parse command line options
+    const char* exe_path = NULL;
+    const char* bf_path = NULL;
+    const char* rewrite_path = NULL;
+    bool memory_given = false;
     int filename_arg = 1;
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] == '-') {
@@ -282,12 +6204,71 @@ int main(int argc, char* argv[]) {
                     if (config.memory_size == 0) {
                         config.memory_size = DEFAULT_MEMORY_SIZE;
                     }
+                    memory_given = true;
                     i++; // Skip the next argument (the memory size)
                 }
                 break;
             case 'z':
                 config.eof_behavior = true;
                 break;
+            case '-':
+                if (strcmp(argv[i], "--compile-to-exe") == 0 && i + 1 < argc) {
+                    exe_path = argv[++i];
+                    break;
+                }
+                if (strcmp(argv[i], "--emit-bf") == 0 && i + 1 < argc) {
+                    bf_path = argv[++i];
+                    break;
+                }
+                if (strcmp(argv[i], "--profile") == 0) {
+                    config.profile = true;
+                    break;
+                }
+                if (strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc) {
+                    config.profile_out = argv[++i];
+                    break;
+                }
+                if (strcmp(argv[i], "--profile-in") == 0 && i + 1 < argc) {
+                    config.profile_in = argv[++i];
+                    break;
+                }
+                if (strcmp(argv[i], "--superoptimize") == 0 && i + 1 < argc) {
+                    rewrite_path = argv[++i];
+                    break;
+                }
+                if (strcmp(argv[i], "--rewrites") == 0 && i + 1 < argc) {
+                    config.rewrites = argv[++i];
+                    break;
+                }
+                if (strcmp(argv[i], "--memo") == 0) {
+                    config.memo = true;
+                    break;
+                }
+                if (strcmp(argv[i], "--jit") == 0) {
+                    config.jit = true;
+                    break;
+                }
+                if (strcmp(argv[i], "--jit-cache") == 0 && i + 1 < argc) {
+                    char* end = NULL;
+                    unsigned long long bytes = strtoull(argv[++i], &end, 10);
+                    if (*end != '\0' || bytes == 0) {
+                        fprintf(stderr, "Error: --jit-cache needs a number of bytes, not %s\n", argv[i]);
+                        return 1;
+                    }
+                    config.jit_cache = (size_t)bytes;
+                    break;
+                }
+                if (strcmp(argv[i], "--break") == 0 && i + 1 < argc) {
+                    if (config.breakpoint_count == MAX_BREAKPOINTS) {
+                        fprintf(stderr, "Error: At most %d breakpoints can be set\n", MAX_BREAKPOINTS);
+                        return 1;
+                    }
+                    config.breakpoints[config.breakpoint_count++] = (size_t)strtoull(argv[++i], NULL, 10);
+                    break;
+                }
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
             default:
                 fprintf(stderr, "Unknown option: %s\n", argv[i]);
                 print_usage(argv[0]);
@@ -308,10 +6289,9 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    // Allocate program buffer
-    char* program = (char*)malloc(MAX_PROGRAM_SIZE * sizeof(char));
-    if (!program) {
-        fprintf(stderr, "Error: Memory allocation failed\n");
+    // A memo hit skips the loop and its inner loops, which would be missing from the profile
+    if (config.memo && config.profile_out) {
+        fprintf(stderr, "Error: --memo cannot be used with --profile-out\n");
         return 1;
     }
 
@@ -320,27 +6300,125 @@ int main(int argc, char* argv[]) {
     errno_t err = fopen_s(&file, argv[filename_arg], "r");
     if (err != 0 || !file) {
         fprintf(stderr, "Error: Could not open file %s\n", argv[filename_arg]);
-        free(program);
         return 1;
     }
 
-    // Read the entire file
-    size_t bytesRead = fread(program, 1, MAX_PROGRAM_SIZE - 1, file);
-    program[bytesRead] = '\0';
+    // Read the entire file, doubling the program buffer whenever it fills
+    size_t capacity = PROGRAM_CHUNK_SIZE;
+    size_t bytesRead = 0;
+    char* program = (char*)malloc(capacity * sizeof(char));
+    while (program) {
+        bytesRead += fread(program + bytesRead, 1, capacity - bytesRead - 1, file);
+        if (bytesRead < capacity - 1) {
+            break;
+        }
+        capacity *= 2;
+        char* grown = (char*)realloc(program, capacity * sizeof(char));
+        if (!grown) {
+            free(program);
+        }
+        program = grown;
+    }
     fclose(file);
+    if (!program) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return 1;
+    }
+    program[bytesRead] = '\0';
 
     // Clean the code
     char* cleaned_code = clean_code(program);
     free(program);
 
+    size_t code_length = strlen(cleaned_code);
+    for (size_t i = 0; i < config.breakpoint_count; i++) {
+        if (config.breakpoints[i] >= code_length) {
+            fprintf(stderr, "Error: Breakpoint %zu is past the end of the program (%zu instructions)\n",
+                config.breakpoints[i], code_length);
+            free(cleaned_code);
+            return 1;
+        }
+    }
+
+    TapeExtent extent;
+    bool bounded = tape_extent(cleaned_code, &extent);
+    if (bounded && memory_given && !config.wrap_memory && extent.reached_high >= (long long)config.memory_size) {
+        fprintf(stderr, "Warning: The program moves to cell %lld before its first loop, but -m gives only %u cells\n",
+            extent.reached_high, config.memory_size);
+    }
+
+    if (rewrite_path) {
+        size_t found = 0;
+        size_t searched = 0;
+        bool saved = superoptimize(cleaned_code, config, rewrite_path, &found, &searched);
+        free(cleaned_code);
+        if (!saved) {
+            return 1;
+        }
+        printf("Rewrote %zu of %zu loops searched in %s, saved to %s\n", found, searched, argv[filename_arg], rewrite_path);
+        return 0;
+    }
+
+    if (bf_path) {
+        size_t written = 0;
+        bool minified = emit_bf(cleaned_code, config, bf_path, &written);
+        if (!minified) {
+            free(cleaned_code);
+            return 1;
+        }
+        printf("Minified %s to %s (%zu of %zu characters)\n", argv[filename_arg], bf_path, written, bytesRead);
+        free(cleaned_code);
+        return 0;
+    }
+
+    if (exe_path) {
+        if (config.debug_mode || config.breakpoint_count > 0) {
+            fprintf(stderr, "Error: Debug mode is not available in compiled executables\n");
+            free(cleaned_code);
+            return 1;
+        }
+        bool precomputed = false;
+        size_t output_length = 0;
+        bool compiled = compile_to_exe(cleaned_code, config, exe_path, &precomputed, &output_length);
+        free(cleaned_code);
+        if (!compiled) {
+            return 1;
+        }
+        if (precomputed) {
+            printf("Compiled %s to %s (reads no input, so its %zu bytes of output were computed now)\n",
+                argv[filename_arg], exe_path, output_length);
+        }
+        else {
+            printf("Compiled %s to %s\n", argv[filename_arg], exe_path);
+        }
+        return 0;
+    }
+
     printf("Running Brainfuck program from: %s\n", argv[filename_arg]);
-    printf("Configuration: Memory Size=%u, Wrapping=%s, Debug=%s, EOF=Set to %s\n\n",
+    printf("Configuration: Memory Size=%u, Wrapping=%s, Debug=%s, EOF=Set to %s\n",
         config.memory_size,
         config.wrap_memory ? "Enabled" : "Disabled",
         config.debug_mode ? "Enabled" : "Disabled",
         config.eof_behavior ? "0" : "Unchanged");
+    if (bounded) {
+        char low[32];
+        char high[32];
+        snprintf(low, sizeof(low), "%lld", extent.low);
+        snprintf(high, sizeof(high), "%lld", extent.high);
+        printf("Reachable Cells: %s to %s\n", extent.low == -EXTENT_UNBOUNDED ? "unbounded" : low,
+            extent.high == EXTENT_UNBOUNDED ? "unbounded" : high);
+    }
+    printf("\n");
 
-    execute_brainfuck(cleaned_code, config);
+    // The JIT does not trace every step or count loops, so -d and --profile-out need the
+    // interpreter. Breakpoints work in JIT code.
+    CodeCache jit_cache;
+    code_cache_init(&jit_cache, config.jit_cache);
+    // Native code keeps no loop counts or memo table, so those runs are interpreted
+    if (!config.jit || config.debug_mode || config.profile_out || config.memo || !jit_run(cleaned_code, config, &jit_cache)) {
+        execute_brainfuck(cleaned_code, config);
+    }
+    code_cache_destroy(&jit_cache);
     printf("\n\nProgram execution complete.\n");
 
     free(cleaned_code);
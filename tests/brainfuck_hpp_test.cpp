@@ -0,0 +1,145 @@
+// Tests for brainfuck.hpp. The static_asserts run when this file is compiled; the program
+// then runs fixed programs with bf::execute and with the interpreter built from
+// sourcecode.c, and compares their output and errors:
+//
+//     gcc -O2 sourcecode.c -o brainfuck
+//     g++ -std=c++20 tests/brainfuck_hpp_test.cpp -o brainfuck_hpp_test
+//     ./brainfuck_hpp_test ./brainfuck
+
+#include "../brainfuck.hpp"
+
+#include <cstdio>
+#include <string>
+
+// The examples from the README
+constexpr auto letter = bf::embed<"++++++++[>++++++++<-]>+.">();
+static_assert(letter.size() == 1 && letter[0] == 'A');
+constexpr auto echo = bf::embed<",[.,]", "hi\n", bf::config{ .eof_zero = true }>();
+static_assert(echo.size() == 3 && echo[0] == 'h' && echo[1] == 'i' && echo[2] == '\n');
+
+// EOF leaves the cell unchanged, or sets it to 0
+constexpr auto unchanged = bf::embed<"+,.">();
+static_assert(unchanged.size() == 1 && unchanged[0] == 1);
+constexpr auto zeroed = bf::embed<"+,.", "", bf::config{ .eof_zero = true }>();
+static_assert(zeroed.size() == 1 && zeroed[0] == 0);
+
+// Multiply loops and clears, and wrapping around the tape
+constexpr auto product = bf::embed<"+++[->++++<]>.[-]+.">();
+static_assert(product.size() == 2 && product[0] == 12 && product[1] == 1);
+constexpr auto wrapped = bf::embed<"<+++.>>>>>.", "", bf::config{ .memory_size = 5, .wrap_memory = true }>();
+static_assert(wrapped.size() == 2 && wrapped[0] == 3 && wrapped[1] == 3);
+
+// Errors come back as a status and the position of the offending character
+constexpr auto off_tape = bf::run<4>("+.>>+<<<<");
+static_assert(off_tape.status == bf::status::out_of_bounds && off_tape.position == 7 && off_tape.length == 1);
+constexpr auto off_end = bf::run<4>(">>>", "", bf::config{ .memory_size = 3 });
+static_assert(off_end.status == bf::status::out_of_bounds && off_end.position == 2);
+static_assert(bf::run<1>("+[").status == bf::status::unmatched_open);
+static_assert(bf::run<1>("+]").status == bf::status::unmatched_close && bf::run<1>("+]").position == 1);
+static_assert(bf::run<1>("+[]", "", bf::config{ .max_steps = 1000 }).status == bf::status::step_limit);
+
+struct test_case {
+    const char* code;
+    const char* input;
+    bf::config options;
+};
+
+constexpr test_case cases[] = {
+    { "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.>++.", "", {} },
+    { ",[.,]", "line one\nline two\n", { .eof_zero = true } },
+    { ",[.,]", "no newline", { .eof_zero = true } },
+    { ",.,.,.,.", "ab", {} },
+    { ",>,[<+>-]<------------------------------------------------.", "3\n4\n", {} },
+    { "+,.,.", "", {} },
+    { "+,.,.", "", { .eof_zero = true } },
+    { "++++[>++++[>++++<-]<-]>>+.[-]<<-[>+<-----]>.", "", {} },
+    { ">+>++>+++>++++>+++++<<<<<[.>]", "", {} },
+    { "-[>+>+<<-]>.>.", "", {} },
+    { "<+++.>>>>>.[-]+++[->>+<]>.", "", { .memory_size = 7, .wrap_memory = true } },
+    { "+++[.>]", "", { .memory_size = 5 } },
+    { "+.<", "", {} },
+    { ">>>>>[-]<<<<<+>>>>>>+[<[.[-]]>[-]]", "", { .memory_size = 5, .wrap_memory = true } },
+};
+
+// Output of the interpreter without its banner lines, and the error it reported, if any
+bool run_interpreter(const std::string& interpreter, const test_case& test, std::string& output, std::string& error) {
+    std::FILE* file = std::fopen("brainfuck_hpp_test.bf", "w");
+    std::FILE* input = std::fopen("brainfuck_hpp_test.in", "w");
+    if (!file || !input) {
+        return false;
+    }
+    std::fputs(test.code, file);
+    std::fputs(test.input, input);
+    std::fclose(file);
+    std::fclose(input);
+
+    std::string command = interpreter + " -m " + std::to_string(test.options.memory_size);
+    command += test.options.wrap_memory ? " -w" : "";
+    command += test.options.eof_zero ? " -z" : "";
+    command += " brainfuck_hpp_test.bf < brainfuck_hpp_test.in 2> brainfuck_hpp_test.err";
+    std::FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        return false;
+    }
+    std::string text;
+    char buffer[4096];
+    for (std::size_t read; (read = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0;) {
+        text.append(buffer, read);
+    }
+    pclose(pipe);
+    std::size_t start = text.find("\n\n");
+    std::size_t end = text.rfind("\n\nProgram execution complete.");
+    if (start == std::string::npos || end == std::string::npos || end < start + 2) {
+        return false;
+    }
+    output = text.substr(start + 2, end - start - 2);
+
+    error.clear();
+    std::FILE* errors = std::fopen("brainfuck_hpp_test.err", "r");
+    char line[256];
+    while (errors && std::fgets(line, sizeof(line), errors)) {
+        if (std::string(line).rfind("Error:", 0) == 0) {
+            error = line;
+        }
+    }
+    if (errors) {
+        std::fclose(errors);
+    }
+    std::remove("brainfuck_hpp_test.bf");
+    std::remove("brainfuck_hpp_test.in");
+    std::remove("brainfuck_hpp_test.err");
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::printf("Usage: %s <interpreter>\n", argv[0]);
+        return 2;
+    }
+    int failures = 0;
+    for (const test_case& test : cases) {
+        std::string expected;
+        bf::outcome done = bf::execute(test.code, test.input, test.options, [&](unsigned char byte) {
+            expected += static_cast<char>(byte);
+            return true;
+        });
+        std::string expected_error;
+        if (done.status == bf::status::out_of_bounds) {
+            expected_error = "Error: Data pointer out of bounds at position " + std::to_string(done.position) + "\n";
+        }
+
+        std::string output;
+        std::string error;
+        if (!run_interpreter(argv[1], test, output, error)) {
+            std::printf("FAIL %s: could not run the interpreter\n", test.code);
+            failures++;
+        }
+        else if (output != expected || error != expected_error) {
+            std::printf("FAIL %s: bf::execute wrote %zu bytes (%s), the interpreter %zu bytes (%s)\n", test.code,
+                expected.size(), expected_error.c_str(), output.size(), error.c_str());
+            failures++;
+        }
+    }
+    std::printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+# Differential tests for the interpreter. Usage:
+#
+#     gcc -O2 sourcecode.c -o brainfuck
+#     python3 tests/differential.py ./brainfuck
+#
+# Each case runs a fixed program and compares what it prints with a known output or
+# with what the plain interpreter prints for it.
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+# Programs with the output they must print: (program, options, expected output)
+REGRESSIONS = [
+    # With -w a segment that passes the tape edge runs from source and wraps, so cell
+    # values and ranges the compiler knew before it are stale
+    ('>>>>>[-]<<<<<+>>>>>>+[<[.[-]]>[-]]', ['-w', '-m', '5'], b'\x01'),
+    ('+[->]>>>>>[-]<<<<<+>>>>>>+[<[.[-]]>[-]]', ['-w', '-m', '5'], b'\x01'),
+    ('+[->]>>>>>[-]<<<<<+>>>>>>+[<+.[-]>[-]]', ['-w', '-m', '5'], b'\x02'),
+    ('+[->]>>>>>[-]+<<<<<+>>>>>[+.[-]]', ['-w', '-m', '5'], b'\x03'),
+]
+
+
+def moves(count):
+    return '>' * count if count > 0 else '<' * -count
+
+
+def adds(count):
+    return '+' * count if count > 0 else '-' * -count
+
+
+def multiply_loop(targets):
+    """A loop that adds factor times its cell to each (offset, factor) target, in order."""
+    body = ''
+    offset = 0
+    for target, factor in targets:
+        body += moves(target - offset) + adds(factor)
+        offset = target
+    return '[-' + body + moves(-offset) + ']'
+
+
+def vector_programs():
+    """Multiply loops and vector adds over 8 to 64 neighbouring cells, which --jit runs
+    with SSE2, AVX2 or AVX-512 depending on the CPU: (program, options, input). Each
+    program starts with a loop whose trip count depends on the input, and reads its loop
+    counts, so the compiler cannot work out the cells in advance and fold the loops away."""
+    programs = []
+    for width in (8, 16, 32, 64):
+        factors = [(1, 2, -1, 3, -2, 5, 7, -3)[i % 8] for i in range(width)]
+        setup = ',[>]<[-]' + ''.join('>' + adds(i % 5 + 1) for i in range(width)) + moves(-width)
+        show = '>.' * width
+        # Targets above the loop cell, every cell and every other cell
+        dense = multiply_loop([(i + 1, factors[i]) for i in range(width)])
+        sparse = multiply_loop([(2 * i + 1, factors[i]) for i in range(width // 2)])
+        programs.append((setup + ',' + dense + show, [], b'\x01\x07'))
+        programs.append((setup + ',' + sparse + show, [], b'\x01\x09'))
+        # Targets below the loop cell, in both orders
+        below = multiply_loop([(-i - 1, factors[i]) for i in range(width)])
+        below_reversed = multiply_loop([(-width + i, factors[i]) for i in range(width)])
+        programs.append((moves(width) + ',' + below + '<.' * width, [], b'\x03'))
+        programs.append((moves(width) + ',' + below_reversed + '<.' * width, [], b'\xfe'))
+        # The last target is the last cell of the tape, so no vector may read past it
+        programs.append((setup + ',' + dense + show, ['-m', str(width + 1)], b'\x01\x05'))
+        programs.append((moves(width) + ',' + below + '<.' * width, ['-m', str(width + 1)], b'\x05'))
+        # Vector adds, including one that ends at the tape edge
+        programs.append((setup + show, ['-m', str(width + 1)], b'\x01'))
+        programs.append(('>>>' + setup + show + moves(-width) + setup + show, [], b'\x01\x01'))
+    return programs
+
+
+def cached_loops():
+    """Eight different loops, run in turn three times over in a different order. Each has
+    code of its own, so with a small --jit-cache some are evicted and compiled again, and
+    the arena is compacted to make room: (program, options, input)."""
+    loops = ['[->' + adds(k + 1) + '[>' + adds(k + 2) + '.<-]>' + moves(k) + '[-]' + moves(-k) + '[-]<<]'
+             for k in range(8)]
+    program = ''.join(adds(k + 2) + loops[(3 * k + r) % 8] for r in range(3) for k in range(8))
+    return [(program, ['--jit-cache', '4096'], b'')]
+
+
+# Programs that must start within STARTUP_SECONDS: (program, options, expected output).
+# Loops that never run cost nothing at startup, however deeply they are nested.
+STARTUP_SECONDS = 1.0
+STARTUP_CASES = [
+    ('[' * 500 + '+' * 2000000 + ']' * 500 + '++++++++[>++++++++<-]>+.', [], b'A'),
+    ('[' * 500 + '+' * 2000000 + ']' * 500 + '++++++++[>++++++++<-]>+.', ['--jit'], b'A'),
+    (('[' * 200 + '-' * 10000 + ']' * 200) * 50 + '++++++++[>++++++++<-]>+.', [], b'A'),
+]
+
+# Programs whose --jit output must match the interpreter's: (program, options, input)
+JIT_CASES = vector_programs()
+
+# Programs whose --jit output with a small code cache must match the interpreter's, with
+# at least one loop evicted and one compaction: (program, options, input)
+CACHE_CASES = cached_loops()
+
+# Programs whose --profile-out file must hold the given counts: (program, options, input,
+# {loop position: (entries, iterations)}). Identical loops share one compiled body, but
+# each copy, and each loop inside it, is counted at its own position.
+PROFILE_CASES = [
+    (',[>+++[>+<-.]<-]>>>,[>+++[>+<-.]<-]', [], b'\x02\x05', {1: (1, 2), 6: (2, 6), 20: (1, 5), 25: (5, 15)}),
+]
+
+# Programs whose --emit-bf version must print the same: (program, options, input)
+EMIT_CASES = [
+    # Comment loops at the start and inside the program, with text around them
+    ('[This program prints A. It uses [nested] comments too.]++++++++[>++++++++<-]>+. done', [], b''),
+    ('+++[-]\n[ a comment loop that never runs ]>++++[<++++++++++>-]<.', [], b''),
+    # A folded prefix: loops at the start that run at compile time, then the rest
+    ('++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.>++.', [], b''),
+    ('+++++[>+++++[>+++<-]<-]>>[>+>+<<-]>.>+.<<[-]>[-]>>[-]<<<,.', [], b'x'),
+    ('+++++[>+++++<-]>[-<++>]<[->+<]>[-]++[>+>+<<-]>>[-<+>]<.', [], b''),
+    # Multiply loops that set up cells, including with factors below zero
+    ('++++++[>+++++++++++<-]>.<+++[>>++++<<-]>>[<+>>---<-]<.>>.', [], b''),
+    ('>+>++>+++>++++<<<<+++[>[->>>>+<<<<]>]>.>.>.>.>.>.>.', [], b''),
+    # I/O before anything can be folded
+    (',[.,]', ['-z'], b'echo this\n'),
+    ('.+.,+.', [], b'a'),
+    (',>,<[->+<]>.', [], b'\x05\x07'),
+    # Wrapping and EOF settings carry over
+    ('<+.>>>>>.', ['-w', '-m', '5'], b''),
+    ('+,.', ['-z'], b''),
+]
+
+
+def emit(interpreter, program, options):
+    """The program as --emit-bf writes it."""
+    with tempfile.NamedTemporaryFile('w', suffix='.bf', delete=False) as source:
+        source.write(program)
+    emitted = source.name + '.min.bf'
+    try:
+        subprocess.run([interpreter] + options + ['--emit-bf', emitted, source.name], capture_output=True, timeout=60)
+        with open(emitted) as file:
+            return file.read()
+    finally:
+        os.remove(source.name)
+        if os.path.exists(emitted):
+            os.remove(emitted)
+
+
+def loop_counts(interpreter, program, options, stdin):
+    """Entries and iterations of each loop that ran, by position, from --profile-out."""
+    with tempfile.NamedTemporaryFile('w', suffix='.bf', delete=False) as source:
+        source.write(program)
+    saved = source.name + '.profile'
+    try:
+        subprocess.run([interpreter] + options + ['--profile-out', saved, source.name], input=stdin,
+                       capture_output=True, timeout=60)
+        with open(saved) as file:
+            lines = file.read().splitlines()[1:]
+        return {int(fields[0]): (int(fields[1]), int(fields[2])) for fields in (line.split() for line in lines)}
+    finally:
+        os.remove(source.name)
+        if os.path.exists(saved):
+            os.remove(saved)
+
+
+def run(interpreter, program, options, stdin=b''):
+    """Run a program and return its output without the interpreter's banner lines."""
+    with tempfile.NamedTemporaryFile('w', suffix='.bf', delete=False) as file:
+        file.write(program)
+    try:
+        result = subprocess.run([interpreter] + options + [file.name], input=stdin, capture_output=True, timeout=60)
+    finally:
+        os.remove(file.name)
+    output = result.stdout
+    start = output.find(b'\n\n') + 2
+    end = output.rfind(b'\n\nProgram execution complete.')
+    return output[start:end] + result.stderr
+
+
+def main():
+    if len(sys.argv) != 2:
+        print('Usage: differential.py <interpreter>')
+        return 2
+    interpreter = sys.argv[1]
+    failures = 0
+    for program, options, expected in REGRESSIONS:
+        for extra in ([], ['--jit']):
+            output = run(interpreter, program, options + extra)
+            if output != expected:
+                print('FAIL %s %s: expected %r, got %r' % (' '.join(options + extra), program, expected, output))
+                failures += 1
+    for program, options, expected in STARTUP_CASES:
+        start = time.monotonic()
+        output = run(interpreter, program, options)
+        seconds = time.monotonic() - start
+        if output != expected or seconds > STARTUP_SECONDS:
+            print('FAIL %s %d loops: expected %r in %.1fs, got %r in %.1fs' % (' '.join(options),
+                program.count('['), expected, STARTUP_SECONDS, output, seconds))
+            failures += 1
+    for program, options, stdin in JIT_CASES:
+        expected = run(interpreter, program, options, stdin)
+        output = run(interpreter, program, options + ['--jit'], stdin)
+        if output != expected:
+            print('FAIL %s --jit %s: expected %r, got %r' % (' '.join(options), program, expected, output))
+            failures += 1
+    for program, options, stdin in CACHE_CASES:
+        expected = run(interpreter, program, [], stdin)
+        output = run(interpreter, program, options + ['--jit', '--profile'], stdin)
+        stats = re.search(rb'JIT code: .* (\d+) evicted, (\d+) compactions\n', output)
+        if not stats or output[:stats.start()] != expected or int(stats.group(1)) == 0 or int(stats.group(2)) == 0:
+            print('FAIL %s --jit %s: expected %r with evictions and compactions, got %r' % (' '.join(options),
+                program, expected, output))
+            failures += 1
+    for program, options, stdin, expected in PROFILE_CASES:
+        counts = loop_counts(interpreter, program, options, stdin)
+        if counts != expected:
+            print('FAIL %s --profile-out %s: expected %r, got %r' % (' '.join(options), program, expected, counts))
+            failures += 1
+    for program, options, stdin in EMIT_CASES:
+        expected = run(interpreter, program, options, stdin)
+        emitted = emit(interpreter, program, options)
+        output = run(interpreter, emitted, options, stdin)
+        if output != expected:
+            print('FAIL %s --emit-bf %r -> %r: expected %r, got %r' % (' '.join(options), program, emitted, expected, output))
+            failures += 1
+    print('%d failures' % failures)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+# Rank the instruction pairs worth fusing into superinstructions. Usage:
+#
+#     gcc -O2 sourcecode.c -o brainfuck
+#     python3 tools/superinstructions.py ./brainfuck [-n count] program.bf...
+#
+# Runs each program with --profile and adds up the share of its instructions that each
+# of its most frequent pairs makes up, so that one long-running program does not outweigh
+# the rest. --profile counts a superinstruction as its two parts, so pairs that are
+# already fused are ranked like any other. Pairs that cannot be fused are skipped:
+# control flow (loops, ifs, guards and block ends) is dispatched on its own, and I/O
+# costs far more than a dispatch.
+#
+# The best pairs are printed as entries for superinstructions[] in sourcecode.c. A new
+# entry also needs its opcode, a name in op_names and a case in execute_bytecode.
+
+import re
+import subprocess
+import sys
+
+NOT_FUSED = {'loop', 'if', 'guard_zero', 'guard_nonzero', 'end', 'trace_end', 'halt', 'input', 'output'}
+
+
+def pair_shares(interpreter, path):
+    """Share of the program's instructions made up by each of its most frequent pairs."""
+    result = subprocess.run([interpreter, '--profile', path], stdin=subprocess.DEVNULL, capture_output=True,
+                            timeout=600)
+    report = result.stderr.decode()
+    section = report.split('Most frequent pairs:\n')[1].split('Most frequent triples:')[0]
+    shares = {}
+    for percent, first, second in re.findall(r'^\s+\d+\s+([\d.]+)%\s+(\w+); (\w+)$', section, re.M):
+        shares[(first, second)] = float(percent) / 100
+    return shares
+
+
+def main():
+    args = sys.argv[2:]
+    count = 5
+    if len(args) >= 2 and args[0] == '-n':
+        count = int(args[1])
+        args = args[2:]
+    if len(sys.argv) < 2 or not args:
+        print('Usage: superinstructions.py <interpreter> [-n count] <program.bf>...')
+        return 2
+    interpreter, programs = sys.argv[1], args
+
+    totals = {}
+    for path in programs:
+        for pair, share in pair_shares(interpreter, path).items():
+            totals[pair] = totals.get(pair, 0.0) + share / len(programs)
+    ranked = sorted((pair for pair in totals if not NOT_FUSED & set(pair)), key=lambda pair: -totals[pair])
+
+    best = ranked[:count]
+    entries = ['    { OP_%s, OP_%s, OP_%s_%s }%s' % (first.upper(), second.upper(), first.upper(), second.upper(),
+               ',' if i + 1 < len(best) else '') for i, (first, second) in enumerate(best)]
+    width = max((len(entry) for entry in entries), default=0)
+    print('// Average share of instructions over %d programs' % len(programs))
+    print('const Superinstruction superinstructions[] = {')
+    for entry, pair in zip(entries, best):
+        print('%s  // %.1f%%' % (entry.ljust(width), 100 * totals[pair]))
+    print('};')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())